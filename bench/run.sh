@@ -0,0 +1,43 @@
+#!/bin/sh
+# times every bench/*.lox script under the threaded and switch builds and
+# divides by the dispatch count to get the cost of one instruction. The
+# interpreter columns run with --no-jit, "reg disp" and "registers" are the
+# threaded build running register code (--registers) and "jit" is the
+# threaded build with the JIT on. Every run compiles from source with
+# --no-cache, a .loxc left by an earlier run would otherwise decide which
+# columns start warm
+
+cd "$(dirname "$0")" || exit 1
+
+now() { date +%s%N; }
+
+dispatches() {
+  ./clox_count --no-cache --no-jit "$@" 2>&1 >/dev/null |
+    sed -n 's/^dispatched \([0-9]*\) instructions$/\1/p'
+}
+
+elapsed() {
+  clox=$1
+  shift
+  start=$(now)
+  "$clox" --no-cache "$@" >/dev/null
+  echo $(($(now) - start))
+}
+
+printf "%-14s %12s %10s %10s %9s %9s %12s %10s %10s\n" "script" \
+  "dispatches" "switch" "threaded" "ns/op sw" "ns/op th" "reg disp" \
+  "registers" "jit"
+
+for script in *.lox; do
+  count=$(dispatches "$script")
+  registerCount=$(dispatches --registers "$script")
+  switchNs=$(elapsed ./clox_switch --no-jit "$script")
+  threadedNs=$(elapsed ./clox_threaded --no-jit "$script")
+  registerNs=$(elapsed ./clox_threaded --no-jit --registers "$script")
+  jitNs=$(elapsed ./clox_threaded "$script")
+
+  awk -v s="$script" -v c="$count" -v sw="$switchNs" -v th="$threadedNs" \
+    -v rc="$registerCount" -v r="$registerNs" -v j="$jitNs" \
+    'BEGIN { printf "%-14s %12d %8.0fms %8.0fms %9.2f %9.2f %12d %8.0fms %8.0fms\n",
+             s, c, sw / 1e6, th / 1e6, sw / c, th / c, rc, r / 1e6, j / 1e6 }'
+done
@@ -0,0 +1,84 @@
+// insert and lookup throughput of Table at a few load factors, linked
+// against the interpreter's own sources by `make bench`
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../include/memory.h"
+#include "../include/object.h"
+#include "../include/table.h"
+#include "../include/vm.h"
+
+// every table below ends up with this many slots
+#define CAPACITY (64 * 1024)
+#define LOOKUPS (4 * 1024 * 1024)
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static ObjString **makeKeys(int count, const char *prefix) {
+  ObjString **keys = malloc(sizeof(ObjString *) * count);
+  for (int i = 0; i < count; i++) {
+    char name[32];
+    int length = snprintf(name, sizeof(name), "%s%d", prefix, i);
+    keys[i] = copyString(name, length);
+  }
+  return keys;
+}
+
+static void run(double load) {
+  int count = (int)(CAPACITY * load);
+  ObjString **keys = makeKeys(count, "key");
+  ObjString **misses = makeKeys(count, "miss");
+
+  Table table;
+  initTable(&table);
+  double start = now();
+  for (int i = 0; i < count; i++) {
+    tableSet(&table, keys[i], NUMBER_VAL(i));
+  }
+  double insert = now() - start;
+
+  Value value;
+  int found = 0;
+  start = now();
+  for (int i = 0; i < LOOKUPS; i++) {
+    found += tableGet(&table, keys[i % count], &value);
+  }
+  double hit = now() - start;
+
+  start = now();
+  for (int i = 0; i < LOOKUPS; i++) {
+    found += tableGet(&table, misses[i % count], &value);
+  }
+  double miss = now() - start;
+
+  printf("%6.3f %9d %10.1f %10.1f %10.1f %s\n",
+         (double)count / table.capacity, count, insert / count * 1e9,
+         hit / LOOKUPS * 1e9, miss / LOOKUPS * 1e9,
+         found == LOOKUPS ? "" : "(lookup mismatch)");
+
+  freeTable(&table);
+  free(keys);
+  free(misses);
+}
+
+int main() {
+  initVM();
+  // the keys live in C arrays the collector can't see
+  vm.nextGC = (size_t)-1;
+  vm.nextMajorGC = (size_t)-1;
+
+  printf("%6s %9s %10s %10s %10s\n", "load", "keys", "insert ns",
+         "hit ns", "miss ns");
+  double loads[] = {0.45, 0.55, 0.65, 0.75, 0.85};
+  for (int i = 0; i < (int)(sizeof(loads) / sizeof(loads[0])); i++) {
+    run(loads[i]);
+  }
+
+  freeVM();
+  return 0;
+}
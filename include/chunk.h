@@ -41,20 +41,78 @@ typedef enum {
   OP_INVOKE,
   OP_GET_SUPER,
   OP_INVOKE_SUPER,
-  OP_INHERIT
+  OP_INHERIT,
+  // specialized forms the VM rewrites generic arithmetic and comparison
+  // into once it has seen their operand types, never emitted by the compiler
+  OP_ADD_NUM_NUM,
+  OP_ADD_STR_STR,
+  OP_SUBTRACT_NUM_NUM,
+  OP_MULTIPLY_NUM_NUM,
+  OP_DIVIDE_NUM_NUM,
+  OP_GREATER_NUM_NUM,
+  OP_LESS_NUM_NUM,
+  // superinstructions the optimizer fuses common sequences into
+  OP_ADD_LOCAL_LOCAL,
+  OP_ADD_LOCAL_CONST,
+  OP_SUBTRACT_LOCAL_CONST,
+  OP_LESS_LOCAL_CONST_JUMP,
+  OP_GREATER_LOCAL_CONST_JUMP,
+  OP_GET_LOCAL_INST,
+  OP_JUMP_IF_FALSE_POP,
+  OP_SET_LOCAL_POP,
+  // three address instructions on frame slots: dst, mode, a, b. A mode bit
+  // makes the operand an index into the constants instead of a slot
+  OP_ADD_REG,
+  OP_SUBTRACT_REG,
+  OP_MULTIPLY_REG,
+  OP_DIVIDE_REG,
+  OP_MOVE_REG // dst, mode, a
 } OpCode;
 
+#define REGISTER_A_CONSTANT 0x01
+#define REGISTER_B_CONSTANT 0x02
+
+typedef struct ObjShape ObjShape;
+typedef struct ObjClosure ObjClosure;
+
+#define INLINE_CACHE_WAYS 4
+
+// what a property access or invoke site resolved to for one receiver shape,
+// either a slot in the instance's field array or a method closure. Shapes
+// belong to a single class and list every field, so a method entry also
+// proves no field shadows the method. Stores that add a field record the
+// shape the instance moves to as well
+typedef struct {
+  ObjShape *shape;
+  int index;
+  ObjClosure *method;
+  ObjShape *transition;
+} InlineCacheEntry;
+
+// per call site cache, the first entry is the monomorphic fast path and the
+// rest catch sites that see a handful of shapes
+typedef struct {
+  int count;
+  InlineCacheEntry entries[INLINE_CACHE_WAYS];
+} InlineCache;
+
 typedef struct {
   int count;
   int capacity;
   uint8_t *code;
   int *lines;
+  // code and lines point into a mapped bytecode image instead of the heap
+  bool borrowed;
   ValueArray constants;
+  int cacheCount;
+  int cacheCapacity;
+  InlineCache *caches;
 } Chunk;
 
 void initChunk(Chunk *chunk);
 void freeChunk(Chunk *chunk);
 void writeChunk(Chunk *chunk, uint8_t byte, int line);
 int addConstant(Chunk *chunk, Value value);
+int addInlineCache(Chunk *chunk);
 
 #endif
@@ -5,10 +5,22 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// pack every Value into a single 64 bit word, comment out to get the
+// tagged union representation back
+#define NAN_BOXING
+
 #define DEBUG_PRINT_CODE
 // #define DEBUG_TRACE_EXECUTION
 //  #define DEBUG_STRESS_GC
 // #define DEBUG_LOG_GC
+// #define DEBUG_COUNT_DISPATCH
+// #define DEBUG_COUNT_PAIRS
+
+// computed goto dispatch for run(), build with DISPATCH=switch to fall back
+// to the plain switch on compilers without labels as values
+#if defined(__GNUC__) && !defined(NO_THREADED_DISPATCH)
+#define THREADED_DISPATCH
+#endif
 
 #define UINT8_COUNT (UINT8_MAX + 1)
 #endif
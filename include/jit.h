@@ -0,0 +1,23 @@
+#ifndef clox_jit_h
+#define clox_jit_h
+
+#include "value.h"
+
+// native code needs NaN boxed values, every Value is then one register wide
+#if defined(__x86_64__) && defined(__linux__) && defined(NAN_BOXING)
+#define JIT_SUPPORTED
+#endif
+
+// calls plus loop back edges a function runs before it is compiled
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 1000
+#endif
+
+typedef struct ObjFunction ObjFunction;
+typedef struct JitCode JitCode;
+
+bool jitCompile(ObjFunction *function);
+uint8_t *jitEnter(ObjFunction *function, Value *slots, uint8_t *ip);
+void jitFree(JitCode *jit);
+
+#endif // !clox_jit_h
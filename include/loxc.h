@@ -0,0 +1,13 @@
+#ifndef clox_loxc_h
+#define clox_loxc_h
+
+#include "object.h"
+
+char *bytecodeCachePath(const char *sourcePath);
+ObjFunction *readBytecodeCache(const char *path, const char *source);
+bool writeBytecodeCache(const char *path, ObjFunction *function,
+                        const char *source);
+void freeBytecodeImages();
+bool relocateGlobals(Chunk *chunk, const int *slots, int slotCount);
+
+#endif // !clox_loxc_h
@@ -2,13 +2,17 @@
 #define clox_memory_h
 
 #include "common.h"
+#include "object.h"
 #include "value.h"
+#include "vm.h"
 
 #define ALLOCATE(type, count)                                                  \
   (type *)reallocate(NULL, 0, sizeof(type) * (count))
 
 #define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
 
+#define FREE_OBJECT(type, pointer) freeBlock(pointer, sizeof(type))
+
 #define GROW_CAPACITY(capacity) ((capacity) < 8 ? 8 : (capacity) * 2)
 
 #define GROW_ARRAY(type, pointer, oldCount, newCount)                          \
@@ -18,9 +22,37 @@
 #define FREE_ARRAY(type, pointer, capacity)                                    \
   reallocate(pointer, sizeof(type) * (capacity), 0)
 
+// objects an incremental major collection blackens per slice, 0 marks the
+// whole heap in one pause
+#ifndef GC_SLICE_BUDGET
+#define GC_SLICE_BUDGET 1000
+#endif
+
 void *reallocate(void *pointer, size_t oldSize, size_t newSize);
+void *allocateBlock(size_t size);
+void freeBlock(void *pointer, size_t size);
 void freeObjects();
 void markValue(Value value);
 void collectGarbage();
 void markObject(Obj *object);
+void rememberObject(Obj *object);
+
+// the write barrier, called after storing child into object. While a major
+// collection is marking in slices the child is shaded gray, so a black
+// object never points at a white one. An old object that now points at a
+// young one is traced by the next minor collection, which would otherwise
+// never look at it
+static inline void writeBarrier(Obj *object, Obj *child) {
+  if (child == NULL)
+    return;
+  if (vm.gcMarking)
+    markObject(child);
+  if (object->isOld && !child->isOld)
+    rememberObject(object);
+}
+
+static inline void writeBarrierValue(Obj *object, Value value) {
+  if (IS_OBJ(value))
+    writeBarrier(object, AS_OBJ(value));
+}
 #endif // !clox_memory_h
@@ -14,6 +14,10 @@
 #define IS_CLASS(value) isObjType(value, OBJ_CLASS)
 #define IS_INSTANCE(value) isObjType(value, OBJ_INSTANCE)
 #define IS_BOUND_METHOD(value) isObjType(value, OBJ_BOUND_METHOD)
+#define IS_SHAPE(value) isObjType(value, OBJ_SHAPE)
+#define IS_ROPE(value) isObjType(value, OBJ_ROPE)
+// a string value, flat or a rope
+#define IS_TEXT(value) (IS_STRING(value) || IS_ROPE(value))
 
 #define AS_STRING(value) ((ObjString *)AS_OBJ(value))
 #define AS_NATIVE(value) (((ObjNative *)AS_OBJ(value))->function)
@@ -23,6 +27,16 @@
 #define AS_CLASS(value) ((ObjClass *)AS_OBJ(value))
 #define AS_INSTANCE(value) ((ObjInstance *)AS_OBJ(value))
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod *)AS_OBJ(value))
+#define AS_SHAPE(value) ((ObjShape *)AS_OBJ(value))
+#define AS_ROPE(value) ((ObjRope *)AS_OBJ(value))
+
+// past these an instance stops sharing shapes and keeps its own table
+#define SHAPE_MAX_FIELDS 64
+#define SHAPE_MAX_TRANSITIONS 32
+// the most fields a new instance is allocated with inline, so an outlier
+// can't bloat its class and a spilled instance leaves at most this many
+// slots unused
+#define FIELD_HINT_MAX 8
 
 typedef enum {
   OBJ_STRING,
@@ -32,12 +46,21 @@ typedef enum {
   OBJ_UPVALUE,
   OBJ_CLASS,
   OBJ_INSTANCE,
-  OBJ_BOUND_METHOD
+  OBJ_BOUND_METHOD,
+  OBJ_SHAPE,
+  // snapshots store ropes as the strings they spell
+  OBJ_ROPE
 } ObjType;
 
+// objects start out young and are promoted to the old generation once they
+// survive a collection. Old objects keep isMarked set between collections,
+// a minor collection then treats them as reachable without tracing them
 struct Obj {
   ObjType type;
   bool isMarked;
+  bool isOld;
+  // already in vm.remembered
+  bool isRemembered;
   struct Obj *next;
 };
 
@@ -48,25 +71,85 @@ typedef struct {
   NativeFn function;
 } ObjNative;
 
+// the characters live in the same allocation, right after the header.
+// Strings made at runtime are neither interned nor hashed until something
+// needs it, interned ones (every table key) always have their hash
 struct ObjString {
   Obj obj;
   int length;
-  char *chars;
   uint32_t hash;
+  bool hasHash;
+  bool isInterned;
+  // the method's index in every class's vtable, -1 until the string is
+  // first used as a method name
+  int selector;
+  char chars[];
+};
+
+#define STRING_SIZE(length) (sizeof(ObjString) + (size_t)(length) + 1)
+
+// a concatenation whose characters are only gathered once something needs
+// them in one piece. Both halves are strings or ropes, they are dropped
+// when the rope is flattened
+typedef struct {
+  Obj obj;
+  int length;
+  Obj *left;
+  Obj *right;
+  ObjString *flat;
+} ObjRope;
+
+typedef void (*RopeVisitor)(ObjString *piece, void *context);
+
+/*
+ * Hidden class describing the field layout of an instance. Shapes form a
+ * transition tree rooted at the class: adding field 'name' to an instance
+ * in shape S moves it to S's child for 'name', whose field lives at slot
+ * fieldCount - 1 of the instance's flat field array.
+ */
+struct ObjShape {
+  Obj obj;
+  struct ObjShape *parent;
+  ObjString *name;
+  int fieldCount;
+  Table transitions;
 };
 
+// methods holds every method by name, the vtable the same closures by
+// selector so a call is an index instead of a hash lookup. It mirrors the
+// table, which keeps the closures alive
 typedef struct {
   Obj obj;
   ObjString *name;
   Table methods;
+  ObjClosure **vtable;
+  int vtableSize;
+  // the vtable's init entry, kept in step by vtableSet and vtableInherit
+  ObjClosure *initializer;
+  ObjShape *rootShape;
+  // the fields the last instance had when init returned, or when it added
+  // one for classes without init. New instances start with room for that
+  // many, up to FIELD_HINT_MAX
+  int fieldHint;
 } ObjClass;
 
 typedef struct {
   Obj obj;
-  Table fields;
   ObjClass *className;
+  // NULL once the instance fell back to dictionary mode, its fields are in
+  // the dictionary table then
+  ObjShape *shape;
+  // points at inlineFields until the instance outgrows them
+  Value *fields;
+  int fieldCapacity;
+  int inlineCapacity;
+  Table dictionary;
+  Value inlineFields[];
 } ObjInstance;
 
+#define INSTANCE_SIZE(inlineCapacity)                                          \
+  (sizeof(ObjInstance) + sizeof(Value) * (size_t)(inlineCapacity))
+
 typedef struct ObjUpvalue {
   Obj obj;
   Value *location;
@@ -74,20 +157,25 @@ typedef struct ObjUpvalue {
   struct ObjUpvalue *next;
 } ObjUpvalue;
 
-typedef struct {
+typedef struct JitCode JitCode;
+
+typedef struct ObjFunction {
   Obj obj;
   int arity;
   int upvalueCount;
   Chunk chunk;
   ObjString *name;
+  int hotness;
+  bool jitFailed;
+  JitCode *jit;
 } ObjFunction;
 
-typedef struct {
+struct ObjClosure {
   Obj obj;
   ObjFunction *function;
   ObjUpvalue **upvalues;
   int upvalueCount;
-} ObjClosure;
+};
 
 typedef struct {
   Obj obj;
@@ -99,20 +187,56 @@ static inline bool isObjType(Value value, ObjType type) {
   return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
-ObjString *takeString(char *chars, int length);
+static inline int textLength(Obj *text) {
+  return text->type == OBJ_ROPE ? ((ObjRope *)text)->length
+                                : ((ObjString *)text)->length;
+}
+
 ObjString *copyString(const char *chars, int length);
+ObjString *newString(int length);
+uint32_t stringHash(ObjString *string);
+bool stringsEqual(ObjString *a, ObjString *b);
+ObjRope *newRope(Obj *left, Obj *right, int length);
+ObjString *flattenRope(ObjRope *rope);
+void visitRope(ObjRope *rope, RopeVisitor visit, void *context);
 ObjUpvalue *newUpvalue(Value *slot);
 void printObject(Value value);
-ObjString *tableFindString(Table *table, const char *chars, int length,
-                           uint32_t hash);
 
 ObjFunction *newFunction();
 ObjNative *newNative(NativeFn function);
 
 ObjClosure *newClosure(ObjFunction *function);
 ObjClass *newClass(ObjString *name);
+int methodSelector(ObjString *name);
+void vtableSet(ObjClass *klass, ObjString *name, ObjClosure *method);
+void vtableInherit(ObjClass *superClass, ObjClass *subClass);
+
+// a method by its selector, NULL if the class has none
+static inline ObjClosure *findMethod(ObjClass *klass, ObjString *name) {
+  return (unsigned)name->selector < (unsigned)klass->vtableSize
+             ? klass->vtable[name->selector]
+             : NULL;
+}
+
+ObjShape *newShape(ObjShape *parent, ObjString *name);
+ObjShape *shapeTransition(ObjShape *shape, ObjString *name);
+int shapeFieldIndex(ObjShape *shape, ObjString *name);
 
 ObjInstance *newInstance(ObjClass *className);
+void setFieldHint(ObjClass *klass, int fieldCount);
+
+// classes without init learn their size from the fields added afterwards,
+// called whenever an instance moves to a bigger shape
+static inline void noteFieldAdded(ObjInstance *instance) {
+  if (instance->className->initializer == NULL) {
+    setFieldHint(instance->className, instance->shape->fieldCount);
+  }
+}
+
+bool instanceGetField(ObjInstance *instance, ObjString *name, Value *value);
+bool instanceSetField(ObjInstance *instance, ObjString *name, Value value);
+void reserveFields(ObjInstance *instance, int capacity);
+void freeFields(ObjInstance *instance);
 ObjBoundMethod *newBoundMethod(Value reciever, ObjClosure *method);
 
 #endif // !clox_object_h
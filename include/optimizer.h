@@ -0,0 +1,9 @@
+#ifndef clox_optimizer_h
+#define clox_optimizer_h
+
+#include "chunk.h"
+
+int instructionLength(Chunk *chunk, int offset);
+void optimizeChunk(Chunk *chunk);
+
+#endif // !clox_optimizer_h
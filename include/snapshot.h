@@ -0,0 +1,10 @@
+#ifndef clox_snapshot_h
+#define clox_snapshot_h
+
+#include "common.h"
+
+bool saveSnapshot(const char *path);
+bool restoreSnapshot(const char *path);
+void markSnapshotRoots();
+
+#endif // !clox_snapshot_h
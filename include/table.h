@@ -2,8 +2,13 @@
 #define clox_table_h
 
 /*
- * It is an open addressing implementation
- * of a hashtable with linear probing
+ * It is an open addressing hashtable probed a group of slots at a time.
+ * Every slot has a control byte, either empty, deleted or the low 7 bits
+ * of its key's hash, and a whole group of control bytes is matched against
+ * a hash in one go (SSE2 when available). Groups are probed quadratically,
+ * the capacity is always a power of two and a multiple of the group width.
+ * Slots that are not full have a NULL key, so entries can be walked
+ * without looking at the control bytes
  *
  */
 
@@ -16,8 +21,12 @@ typedef struct {
 } Entry;
 
 typedef struct {
+  // full slots
   int count;
+  // deleted slots, which still lengthen probes until the table is rehashed
+  int tombstones;
   int capacity;
+  uint8_t *control;
   Entry *entries;
 } Table;
 
@@ -27,6 +36,8 @@ bool tableSet(Table *table, ObjString *key, Value value);
 void tableAddAll(Table *from, Table *to);
 bool tableGet(Table *table, ObjString *key, Value *value);
 bool tableDelete(Table *table, ObjString *key);
+ObjString *tableFindString(Table *table, const char *chars, int length,
+                           uint32_t hash);
 void markTable(Table *table);
 void tableRemoveWhite(Table *table);
 
@@ -14,23 +14,53 @@ typedef struct {
   ObjClosure *closure;
   uint8_t *ip;
   Value *slots;
+  // an initializer called to construct an instance
+  bool isConstruction;
 } CallFrame;
 
+// a global variable resolved to a fixed slot at compile time, slots exist
+// as soon as a name is referenced but only hold a value once defined
+typedef struct {
+  ObjString *name;
+  Value value;
+  bool isDefined;
+} GlobalVar;
+
 typedef struct {
   CallFrame frames[FRAMES_MAX];
   int frameCount;
   Value stack[STACK_MAX];
   Value *stackTop;
   Table strings;
-  Table globals;
+  Table globalNames;
+  GlobalVar *globals;
+  int globalCount;
+  int globalCapacity;
   ObjUpvalue *openUpvalues;
+  // the young generation, everything allocated since the last collection
   Obj *objects;
+  Obj *oldObjects;
+  // old objects written to point at young ones since the last collection
+  Obj **remembered;
+  int rememberedCount;
+  int rememberedCapacity;
   int grayCount;
   int grayCapacity;
   Obj **grayStack;
   size_t bytesAllocated;
   size_t nextGC;
+  // a collection past this also collects the old generation
+  size_t nextMajorGC;
+  // a major collection is marking a slice at a time
+  bool gcMarking;
+  int gcSliceBudget;
   ObjString *initString;
+  // method selectors handed out so far, the size vtables grow to
+  int selectorCount;
+  // compile `local = expr;` statements to register instructions
+  bool registerCode;
+  // compile hot functions to native code, off with --no-jit
+  bool jitEnabled;
 } VM;
 
 typedef enum {
@@ -42,6 +72,11 @@ typedef enum {
 void initVM();
 void freeVM();
 InterpretResult interpret(const char *source);
+InterpretResult interpretFunction(ObjFunction *function);
+int globalSlot(ObjString *name);
+const char *nativeName(NativeFn function);
+NativeFn findNative(const char *name, int length);
+void concatenate();
 
 extern VM vm;
 
@@ -2,8 +2,10 @@
 #include "../include/debug.h"
 #include "../include/memory.h"
 #include "../include/object.h"
+#include "../include/optimizer.h"
 #include "../include/scanner.h"
 #include "../include/value.h"
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -78,13 +80,37 @@ struct {
   bool panicMode;
 } parser;
 
+// what binary() and unary() know about the value the last expression left
+// on the stack, whose code ends at end. A constant is a single load
+// instruction at start, the others only promise the value's type.
+// isNegation marks a bool that ends in an OP_NOT of another bool
+typedef enum {
+  EXPR_UNKNOWN,
+  EXPR_CONSTANT,
+  EXPR_NUMBER,
+  EXPR_BOOL,
+} ExprKind;
+
+typedef struct {
+  ExprKind kind;
+  int start;
+  int end;
+  bool isNegation;
+} ExprInfo;
+
+// only valid right after the expression, emitting anything, patching a
+// jump to land after it or switching functions forgets it
+static ExprInfo lastExpr;
+
 static ParseRule *getRule(TokenType type);
 static void parsePrecidence(Precedence precedence);
 static void statement();
 static void declaration();
-static uint8_t parseVariable(char *errorMessage);
-static void defineVariable(uint8_t global);
+static uint16_t parseVariable(char *errorMessage);
+static void defineVariable(uint16_t global);
 static uint8_t identifierConstant(Token *name);
+static uint8_t selectorConstant(Token *name);
+static uint16_t identifierGlobal(Token *name);
 static void declareVariable();
 static void namedVariable(Token name, bool canAssign);
 static void variable(bool canAssign);
@@ -103,9 +129,11 @@ static void initCompiler(Compiler *compiler, FunctionType type) {
   compiler->scopeDepth = 0;
   compiler->function = newFunction();
   current = compiler;
+  lastExpr.kind = EXPR_UNKNOWN;
   if (type != TYPE_SCRIPT) {
     current->function->name =
         copyString(parser.previous.start, parser.previous.length);
+    writeBarrier((Obj *)current->function, (Obj *)current->function->name);
   }
 
   Local *local = &current->locals[current->localCount++];
@@ -179,6 +207,7 @@ static bool match(TokenType type) {
 // --- compiler logic
 static void emitByte(uint8_t byte) {
   writeChunk(currentChunk(), byte, parser.previous.line);
+  lastExpr.kind = EXPR_UNKNOWN;
 }
 
 static void emitBytes(uint8_t byte, uint8_t byte2) {
@@ -201,8 +230,8 @@ static void emitLoop(uint16_t start) {
   emitByte(offset & 0xff);
 }
 
-static void patchJump(uint8_t slot) {
-  uint16_t gap = currentChunk()->count - slot - 2;
+static void patchJump(int slot) {
+  int gap = currentChunk()->count - slot - 2;
 
   if (gap > UINT16_MAX) {
     error("max jump limit exceeded", &parser.current);
@@ -210,6 +239,7 @@ static void patchJump(uint8_t slot) {
 
   currentChunk()->code[slot] = (gap >> 8) & 0xff;
   currentChunk()->code[slot + 1] = gap & 0xff;
+  lastExpr.kind = EXPR_UNKNOWN;
 }
 
 static void emitReturn() {
@@ -224,6 +254,9 @@ static void emitReturn() {
 static ObjFunction *endCompiler() {
   emitReturn();
   ObjFunction *function = current->function;
+  if (!parser.hasError) {
+    optimizeChunk(currentChunk());
+  }
 
 #ifdef DEBUG_PRINT_CODE
   if (!parser.hasError) {
@@ -233,6 +266,7 @@ static ObjFunction *endCompiler() {
   }
 #endif /* ifdef DEBUG_PRINT_CODE */
   current = current->enclosing;
+  lastExpr.kind = EXPR_UNKNOWN;
   return function;
 }
 
@@ -260,7 +294,7 @@ static void synchronize() {
 static void expression() { parsePrecidence(PREC_ASSIGNMENT); }
 
 static void varDeclaration() {
-  uint8_t global = parseVariable("Expect variable name.");
+  uint16_t global = parseVariable("Expect variable name.");
 
   if (match(TOKEN_EQUAL)) {
     expression();
@@ -278,10 +312,121 @@ static void printStatement() {
   emitByte(OP_PRINT);
 }
 
+// where a register instruction operand is read from while stack code is
+// translated, a temporary result lives in the destination slot
+typedef struct {
+  bool isConstant;
+  bool isTemp;
+  uint8_t index;
+} RegisterOperand;
+
+#define REGISTER_RUN_MAX 32
+
+static uint8_t registerOpcode(uint8_t op) {
+  switch (op) {
+  case OP_ADD:
+    return OP_ADD_REG;
+  case OP_SUBTRACT:
+    return OP_SUBTRACT_REG;
+  case OP_MULTIPLY:
+    return OP_MULTIPLY_REG;
+  default:
+    return OP_DIVIDE_REG;
+  }
+}
+
+// the register code generator, replaces the stack code emitted since start
+// for a `local = expr;` statement with three address instructions that work
+// on frame slots directly. Only locals, constants and arithmetic are handled
+// and at most one intermediate result may be live, anything else keeps its
+// stack code
+static void registerStatement(int start) {
+  Chunk *chunk = currentChunk();
+  if (!vm.registerCode || parser.hasError) return;
+
+  int offsets[REGISTER_RUN_MAX];
+  int count = 0;
+  for (int offset = start; offset < chunk->count;
+       offset += instructionLength(chunk, offset)) {
+    if (count == REGISTER_RUN_MAX) return;
+    offsets[count++] = offset;
+  }
+
+  if (count < 3 || chunk->code[offsets[count - 1]] != OP_POP ||
+      chunk->code[offsets[count - 2]] != OP_SET_LOCAL) {
+    return;
+  }
+  uint8_t dst = chunk->code[offsets[count - 2] + 1];
+
+  RegisterOperand stack[REGISTER_RUN_MAX];
+  int depth = 0;
+  uint8_t code[REGISTER_RUN_MAX * 5];
+  int length = 0;
+
+  for (int i = 0; i < count - 2; i++) {
+    uint8_t *instruction = &chunk->code[offsets[i]];
+    switch (instruction[0]) {
+    case OP_CONSTANT:
+      stack[depth++] = (RegisterOperand){true, false, instruction[1]};
+      break;
+
+    case OP_GET_LOCAL:
+      // the temporary already overwrote the destination's old value
+      for (int j = 0; j < depth; j++) {
+        if (stack[j].isTemp && instruction[1] == dst) return;
+      }
+      stack[depth++] = (RegisterOperand){false, false, instruction[1]};
+      break;
+
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE: {
+      RegisterOperand b = stack[--depth];
+      RegisterOperand a = stack[--depth];
+
+      // writing the destination would clobber an operand still waiting on
+      // the stack, either the destination itself or the live temporary
+      for (int j = 0; j < depth; j++) {
+        if (!stack[j].isConstant && stack[j].index == dst) return;
+      }
+
+      code[length++] = registerOpcode(instruction[0]);
+      code[length++] = dst;
+      code[length++] = (a.isConstant ? REGISTER_A_CONSTANT : 0) |
+                       (b.isConstant ? REGISTER_B_CONSTANT : 0);
+      code[length++] = a.index;
+      code[length++] = b.index;
+      stack[depth++] = (RegisterOperand){false, true, dst};
+      break;
+    }
+
+    default:
+      return;
+    }
+  }
+
+  RegisterOperand result = stack[0];
+  if (!result.isTemp && (result.isConstant || result.index != dst)) {
+    code[length++] = OP_MOVE_REG;
+    code[length++] = dst;
+    code[length++] = result.isConstant ? REGISTER_A_CONSTANT : 0;
+    code[length++] = result.index;
+  }
+
+  int line = chunk->lines[start];
+  chunk->count = start;
+  for (int i = 0; i < length; i++) {
+    writeChunk(chunk, code[i], line);
+  }
+}
+
 static void expressionStatement() {
+  int start = currentChunk()->count;
   expression();
   consume((TOKEN_SEMICOLON), "Expect ';' after value.");
   emitByte(OP_POP);
+  registerStatement(start);
 }
 
 static void markInitialized() {
@@ -315,7 +460,8 @@ static void endScope() {
 }
 
 static uint8_t makeConstant(Value value) {
-  uint8_t constant = addConstant(currentChunk(), value);
+  int constant = addConstant(currentChunk(), value);
+  writeBarrierValue((Obj *)current->function, value);
   if (constant > UINT8_MAX) {
     error("Too many constants in one chunk", &parser.current);
     return 0;
@@ -336,8 +482,8 @@ static void function(FunctionType type) {
         error("Can't have more than 255 parameters.", &parser.current);
       }
 
-      uint8_t constant = parseVariable("Expect parameter name");
-      defineVariable(constant);
+      uint16_t local = parseVariable("Expect parameter name");
+      defineVariable(local);
 
     } while (match(TOKEN_COMMA));
   }
@@ -356,7 +502,7 @@ static void function(FunctionType type) {
 }
 
 static void funDeclaration() {
-  uint8_t global = parseVariable("Expect function name");
+  uint16_t global = parseVariable("Expect function name");
   markInitialized();
   function(TYPE_FUNCTION);
   defineVariable(global);
@@ -364,7 +510,7 @@ static void funDeclaration() {
 
 static void method() {
   consume(TOKEN_IDENTIFIER, "Expect method name");
-  uint8_t constant = identifierConstant(&parser.previous);
+  uint8_t constant = selectorConstant(&parser.previous);
 
   FunctionType type = TYPE_METHOD;
   if (parser.previous.length == 4 &&
@@ -405,7 +551,7 @@ static void _super(bool canAssign) {
     error("Can't use 'super' without a superclass.", &parser.previous);
   consume(TOKEN_DOT, "Expect '.' after super");
   consume(TOKEN_IDENTIFIER, "Expect superclass method name.");
-  uint8_t name = identifierConstant(&parser.previous);
+  uint8_t name = selectorConstant(&parser.previous);
 
   namedVariable(syntheticToken("this"), false);
 
@@ -425,9 +571,10 @@ static void classDeclaration() {
   Token className = parser.previous;
   uint8_t nameConstant = identifierConstant(&parser.previous);
   declareVariable();
+  uint16_t global = current->scopeDepth > 0 ? 0 : identifierGlobal(&className);
 
   emitBytes(OP_CLASS, nameConstant);
-  defineVariable(nameConstant);
+  defineVariable(global);
 
   ClassCompiler classCompiler;
   classCompiler.hasSuperclass = false;
@@ -546,6 +693,7 @@ static void forStatement() {
     uint16_t middleJump = currentChunk()->count;
     expression();
     emitByte(OP_POP);
+    registerStatement(middleJump);
     consume(TOKEN_RIGHT_PAREN, "Expect ')' at end of for statement");
 
     emitLoop(loopStart);
@@ -604,18 +752,98 @@ static void grouping(bool canAssign) {
   consume(TOKEN_RIGHT_PAREN, "Expected ')' at end of expression");
 }
 
+// every property access and invoke site gets its own inline cache
+static void emitInlineCache() {
+  int cache = addInlineCache(currentChunk());
+  if (cache > UINT16_MAX) {
+    error("Too many property accesses in one chunk.", &parser.previous);
+  }
+  emitBytes((cache >> 8) & 0xff, cache & 0xff);
+}
+
 static void emitConstant(Value value) {
   emitBytes(OP_CONSTANT, makeConstant(value));
 }
 
+static void setExpr(ExprKind kind) {
+  lastExpr.kind = kind;
+  lastExpr.end = currentChunk()->count;
+  lastExpr.isNegation = false;
+}
+
+// the expression just compiled, unknown unless its code is what the chunk
+// ends with
+static ExprInfo currentExpr() {
+  if (lastExpr.end != currentChunk()->count) {
+    return (ExprInfo){EXPR_UNKNOWN, 0, 0, false};
+  }
+  return lastExpr;
+}
+
+// loads any constant, nil and the bools get their own instructions
+static void emitLoad(Value value) {
+  int start = currentChunk()->count;
+  if (IS_NIL(value)) {
+    emitByte(OP_NIL);
+  } else if (IS_BOOL(value)) {
+    emitByte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+  } else {
+    emitConstant(value);
+  }
+  setExpr(EXPR_CONSTANT);
+  lastExpr.start = start;
+}
+
+static Value constantValue(ExprInfo expr) {
+  uint8_t *code = &currentChunk()->code[expr.start];
+  switch (code[0]) {
+  case OP_NIL:
+    return NIL_VAL;
+  case OP_TRUE:
+    return BOOL_VAL(true);
+  case OP_FALSE:
+    return BOOL_VAL(false);
+  default:
+    return currentChunk()->constants.values[code[1]];
+  }
+}
+
+static bool isNumberExpr(ExprInfo expr) {
+  return expr.kind == EXPR_NUMBER ||
+         (expr.kind == EXPR_CONSTANT && IS_NUMBER(constantValue(expr)));
+}
+
+static bool isBoolExpr(ExprInfo expr) {
+  return expr.kind == EXPR_BOOL ||
+         (expr.kind == EXPR_CONSTANT && IS_BOOL(constantValue(expr)));
+}
+
+// takes a constant load out of the code, the code after it moves up. Its
+// constant goes too when it is the last in the pool, constants are never
+// shared so nothing else can use it
+static void removeLoad(ExprInfo load) {
+  Chunk *chunk = currentChunk();
+  int length = chunk->code[load.start] == OP_CONSTANT ? 2 : 1;
+  if (length == 2 &&
+      chunk->code[load.start + 1] == chunk->constants.count - 1) {
+    chunk->constants.count--;
+  }
+
+  int end = load.start + length;
+  memmove(&chunk->code[load.start], &chunk->code[end], chunk->count - end);
+  memmove(&chunk->lines[load.start], &chunk->lines[end],
+          sizeof(int) * (chunk->count - end));
+  chunk->count -= length;
+}
+
 static void number(bool canAssign) {
   double value = strtod(parser.previous.start, NULL);
-  emitConstant(NUMBER_VAL(value));
+  emitLoad(NUMBER_VAL(value));
 }
 
 static void string(bool canAssign) {
   // take string from previous token start to end without the " "
-  emitConstant(OBJ_VAL(
+  emitLoad(OBJ_VAL(
       copyString(parser.previous.start + 1, parser.previous.length - 2)));
 }
 
@@ -686,16 +914,24 @@ static void namedVariable(Token name, bool canAssign) {
     getOp = OP_GET_UPVALUE;
     setOp = OP_SET_UPVALUE;
   } else {
-    arg = identifierConstant(&name);
+    arg = identifierGlobal(&name);
     getOp = OP_GET_GLOBAL;
     setOp = OP_SET_GLOBAL;
   }
 
+  bool isGlobal = getOp == OP_GET_GLOBAL;
   if (canAssign && match(TOKEN_EQUAL)) {
     expression();
-    emitBytes(setOp, (uint8_t)arg);
+    emitByte(setOp);
+  } else {
+    emitByte(getOp);
+  }
+
+  // globals are addressed by a 16 bit slot in the VM's globals array
+  if (isGlobal) {
+    emitBytes((arg >> 8) & 0xff, arg & 0xff);
   } else {
-    emitBytes(getOp, (uint8_t)arg);
+    emitByte((uint8_t)arg);
   }
 }
 
@@ -715,13 +951,13 @@ static void _this(bool canAssign) {
 static void literal(bool canAssign) {
   switch (parser.previous.type) {
   case TOKEN_FALSE:
-    emitByte(OP_FALSE);
+    emitLoad(BOOL_VAL(false));
     break;
   case TOKEN_NIL:
-    emitByte(OP_NIL);
+    emitLoad(NIL_VAL);
     break;
   case TOKEN_TRUE:
-    emitByte(OP_TRUE);
+    emitLoad(BOOL_VAL(true));
     break;
 
   default:
@@ -741,14 +977,18 @@ static void dot(bool canAssign) {
   if (canAssign && match(TOKEN_EQUAL)) {
     expression();
     emitBytes(OP_SET_INST, name);
+    emitInlineCache();
     return;
   } else if (match(TOKEN_LEFT_PAREN)) {
+    methodSelector(AS_STRING(currentChunk()->constants.values[name]));
     uint8_t argCount = argumentList();
     emitBytes(OP_INVOKE, name);
     emitByte(argCount);
+    emitInlineCache();
     return;
   }
   emitBytes(OP_GET_INST, name);
+  emitInlineCache();
 }
 
 static void _and(bool canAssign) {
@@ -768,59 +1008,205 @@ static void _or(bool canAssign) {
   patchJump(endJump);
 }
 
+// !x, which takes the last OP_NOT back off when x is already a negated bool
+static void emitNot(ExprInfo operand) {
+  if (operand.kind == EXPR_BOOL && operand.isNegation) {
+    currentChunk()->count--;
+    setExpr(EXPR_BOOL);
+    return;
+  }
+  emitByte(OP_NOT);
+  setExpr(EXPR_BOOL);
+  lastExpr.isNegation = isBoolExpr(operand);
+}
+
 static void unary(bool canAssign) {
   TokenType operatorType = parser.previous.type;
 
   parsePrecidence(PREC_UNARY);
+  ExprInfo operand = currentExpr();
+  Value value =
+      operand.kind == EXPR_CONSTANT ? constantValue(operand) : NIL_VAL;
   switch (operatorType) {
   case TOKEN_MINUS:
+    if (operand.kind == EXPR_CONSTANT && IS_NUMBER(value)) {
+      removeLoad(operand);
+      emitLoad(NUMBER_VAL(-AS_NUMBER(value)));
+      return;
+    }
     emitByte(OP_NEGATE);
+    setExpr(EXPR_NUMBER);
     break;
   case TOKEN_BANG:
-    emitByte(OP_NOT);
+    if (operand.kind == EXPR_CONSTANT) {
+      removeLoad(operand);
+      emitLoad(BOOL_VAL(IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value))));
+      return;
+    }
+    emitNot(operand);
+    break;
   default:
     return;
   }
 }
 
+// the operator applied at compile time, false when it is left to the VM,
+// which has an error to report for those operands
+static bool foldBinary(TokenType operatorType, Value a, Value b,
+                       Value *result) {
+  if (operatorType == TOKEN_EQUAL_EQUAL || operatorType == TOKEN_BANG_EQUAL) {
+    *result =
+        BOOL_VAL(valuesEqual(a, b) == (operatorType == TOKEN_EQUAL_EQUAL));
+    return true;
+  }
+
+  if (operatorType == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b)) {
+    ObjString *left = AS_STRING(a);
+    ObjString *right = AS_STRING(b);
+    int length = left->length + right->length;
+    char *chars = ALLOCATE(char, length + 1);
+    memcpy(chars, left->chars, left->length);
+    memcpy(chars + left->length, right->chars, right->length);
+    *result = OBJ_VAL(copyString(chars, length));
+    FREE_ARRAY(char, chars, length + 1);
+    return true;
+  }
+
+  if (!IS_NUMBER(a) || !IS_NUMBER(b))
+    return false;
+
+  double x = AS_NUMBER(a);
+  double y = AS_NUMBER(b);
+  switch (operatorType) {
+  case TOKEN_PLUS:
+    *result = NUMBER_VAL(x + y);
+    return true;
+  case TOKEN_MINUS:
+    *result = NUMBER_VAL(x - y);
+    return true;
+  case TOKEN_STAR:
+    *result = NUMBER_VAL(x * y);
+    return true;
+  case TOKEN_SLASH:
+    *result = NUMBER_VAL(x / y);
+    return true;
+  case TOKEN_GREATER:
+    *result = BOOL_VAL(x > y);
+    return true;
+  case TOKEN_LESS:
+    *result = BOOL_VAL(x < y);
+    return true;
+  // negated like the instructions they compile to, which matters for NaN
+  case TOKEN_GREATER_EQUAL:
+    *result = BOOL_VAL(!(x < y));
+    return true;
+  case TOKEN_LESS_EQUAL:
+    *result = BOOL_VAL(!(x > y));
+    return true;
+  default:
+    return false;
+  }
+}
+
+// x * 1, 1 * x, x / 1 and x - 0 for numbers, x == true and the like for
+// bools. None of them hold for every value, so the other operand's type has
+// to be known. x + 0 is left alone since it turns -0 into 0
+static bool simplifyBinary(TokenType operatorType, ExprInfo left,
+                           ExprInfo right) {
+  bool constantOnRight = right.kind == EXPR_CONSTANT;
+  ExprInfo constant = constantOnRight ? right : left;
+  ExprInfo other = constantOnRight ? left : right;
+  if (constant.kind != EXPR_CONSTANT)
+    return false;
+
+  Value value = constantValue(constant);
+  bool negate = false;
+  if (IS_NUMBER(value) && isNumberExpr(other)) {
+    double n = AS_NUMBER(value);
+    bool identity =
+        (n == 1 && operatorType == TOKEN_STAR) ||
+        (n == 1 && operatorType == TOKEN_SLASH && constantOnRight) ||
+        (n == 0 && !signbit(n) && operatorType == TOKEN_MINUS &&
+         constantOnRight);
+    if (!identity)
+      return false;
+  } else if (IS_BOOL(value) && isBoolExpr(other) &&
+             (operatorType == TOKEN_EQUAL_EQUAL ||
+              operatorType == TOKEN_BANG_EQUAL)) {
+    negate = AS_BOOL(value) != (operatorType == TOKEN_EQUAL_EQUAL);
+  } else {
+    return false;
+  }
+
+  removeLoad(constant);
+  lastExpr = other;
+  lastExpr.end = currentChunk()->count;
+  if (negate) {
+    emitNot(other);
+  }
+  return true;
+}
+
 static void binary(bool canAssign) {
   TokenType operatorType = parser.previous.type;
   ParseRule *rule = getRule(operatorType);
+  ExprInfo left = currentExpr();
   parsePrecidence(((Precedence)(rule->precedence + 1)));
+  ExprInfo right = currentExpr();
+
+  Value result;
+  if (left.kind == EXPR_CONSTANT && right.kind == EXPR_CONSTANT &&
+      foldBinary(operatorType, constantValue(left), constantValue(right),
+                 &result)) {
+    removeLoad(right);
+    removeLoad(left);
+    emitLoad(result);
+    return;
+  }
+  if (simplifyBinary(operatorType, left, right))
+    return;
 
   switch (operatorType) {
   case TOKEN_PLUS:
     emitByte((OP_ADD));
+    setExpr(isNumberExpr(left) && isNumberExpr(right) ? EXPR_NUMBER
+                                                      : EXPR_UNKNOWN);
     break;
   case TOKEN_MINUS:
     emitByte((OP_SUBTRACT));
+    setExpr(EXPR_NUMBER);
     break;
   case TOKEN_STAR:
     emitByte((OP_MULTIPLY));
+    setExpr(EXPR_NUMBER);
     break;
   case TOKEN_SLASH:
     emitByte((OP_DIVIDE));
+    setExpr(EXPR_NUMBER);
     break;
   case TOKEN_BANG_EQUAL:
     emitByte((OP_EQUAL));
-    emitByte((OP_NOT));
+    emitNot((ExprInfo){EXPR_BOOL, 0, 0, false});
     break;
   case TOKEN_EQUAL_EQUAL:
     emitByte((OP_EQUAL));
+    setExpr(EXPR_BOOL);
     break;
   case TOKEN_GREATER:
     emitByte((OP_GREATER));
+    setExpr(EXPR_BOOL);
     break;
   case TOKEN_GREATER_EQUAL:
     emitByte((OP_LESS));
-    emitByte((OP_NOT));
+    emitNot((ExprInfo){EXPR_BOOL, 0, 0, false});
     break;
   case TOKEN_LESS:
     emitByte((OP_LESS));
+    setExpr(EXPR_BOOL);
     break;
   case TOKEN_LESS_EQUAL:
     emitByte((OP_GREATER));
-    emitByte((OP_NOT));
+    emitNot((ExprInfo){EXPR_BOOL, 0, 0, false});
     break;
   default:
     return;
@@ -874,6 +1260,7 @@ ParseRule rules[] = {
 static ParseRule *getRule(TokenType type) { return &rules[type]; }
 
 static void parsePrecidence(Precedence precedence) {
+  lastExpr.kind = EXPR_UNKNOWN;
   advance();
   ParseFn prefixRule = getRule(parser.previous.type)->prefix;
   if (prefixRule == NULL) {
@@ -898,6 +1285,22 @@ static uint8_t identifierConstant(Token *name) {
   return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
 }
 
+// a method name, given its vtable selector while compiling
+static uint8_t selectorConstant(Token *name) {
+  uint8_t constant = identifierConstant(name);
+  methodSelector(AS_STRING(currentChunk()->constants.values[constant]));
+  return constant;
+}
+
+static uint16_t identifierGlobal(Token *name) {
+  int slot = globalSlot(copyString(name->start, name->length));
+  if (slot > UINT16_MAX) {
+    error("Too many global variables.", name);
+    return 0;
+  }
+  return (uint16_t)slot;
+}
+
 static void addLocal(Token name) {
   if (current->localCount == UINT8_COUNT) {
     error("TOO many local variables in function.", &parser.current);
@@ -928,7 +1331,7 @@ static void declareVariable() {
   addLocal(*name);
 }
 
-static uint8_t parseVariable(char *errorMessage) {
+static uint16_t parseVariable(char *errorMessage) {
   consume(TOKEN_IDENTIFIER, errorMessage);
 
   declareVariable();
@@ -936,15 +1339,16 @@ static uint8_t parseVariable(char *errorMessage) {
     return 0;
   }
 
-  return identifierConstant(&parser.previous);
+  return identifierGlobal(&parser.previous);
 }
 
-static void defineVariable(uint8_t global) {
+static void defineVariable(uint16_t global) {
   if (current->scopeDepth > 0) {
     markInitialized();
     return;
   }
-  emitBytes(OP_DEFINE_GLOBAL, global);
+  emitByte(OP_DEFINE_GLOBAL);
+  emitBytes((global >> 8) & 0xff, global & 0xff);
 }
 
 ObjFunction *compile(const char *source) {
@@ -4,6 +4,7 @@
 #include "../include/chunk.h"
 #include "../include/debug.h"
 #include "../include/object.h"
+#include "../include/vm.h"
 
 void disassembleChunk(Chunk *chunk, const char *name) {
   printf("== %s ==\n", name);
@@ -40,6 +41,72 @@ static int constInstruction(const char *name, Chunk *chunk, int offset) {
   return offset + 2;
 }
 
+static int globalInstruction(const char *name, Chunk *chunk, int offset) {
+  uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8);
+  slot |= chunk->code[offset + 2];
+  printf("%-16s %4d '%s'\n", name, slot, vm.globals[slot].name->chars);
+  return offset + 3;
+}
+
+static int localConstInstruction(const char *name, Chunk *chunk,
+                                 int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  uint8_t constant = chunk->code[offset + 2];
+  printf("%-16s %4d %4d '", name, slot, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("'\n");
+  return offset + 3;
+}
+
+static int compareJumpInstruction(const char *name, Chunk *chunk,
+                                  int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  uint8_t constant = chunk->code[offset + 2];
+  uint16_t jump = (uint16_t)(chunk->code[offset + 3] << 8);
+  jump |= chunk->code[offset + 4];
+  printf("%-16s %4d %4d '", name, slot, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("' %d -> %d\n", offset, offset + 5 + jump);
+  return offset + 5;
+}
+
+static int localCachedInstruction(const char *name, Chunk *chunk,
+                                  int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  uint8_t constant = chunk->code[offset + 2];
+  uint16_t cache = (uint16_t)(chunk->code[offset + 3] << 8);
+  cache |= chunk->code[offset + 4];
+  printf("%-16s %4d %4d '", name, slot, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("' ic %d\n", cache);
+  return offset + 5;
+}
+
+static void printRegister(Chunk *chunk, bool isConstant, uint8_t index) {
+  if (isConstant) {
+    printf(" k%d '", index);
+    printValue(chunk->constants.values[index]);
+    printf("'");
+  } else {
+    printf(" r%d", index);
+  }
+}
+
+static int registerInstruction(const char *name, Chunk *chunk, int offset) {
+  uint8_t dst = chunk->code[offset + 1];
+  uint8_t mode = chunk->code[offset + 2];
+  printf("%-16s r%d <-", name, dst);
+  printRegister(chunk, mode & REGISTER_A_CONSTANT, chunk->code[offset + 3]);
+  if (chunk->code[offset] == OP_MOVE_REG) {
+    printf("\n");
+    return offset + 4;
+  }
+
+  printRegister(chunk, mode & REGISTER_B_CONSTANT, chunk->code[offset + 4]);
+  printf("\n");
+  return offset + 5;
+}
+
 static int invokeInstruction(const char *name, Chunk *chunk, int offset) {
   uint8_t constant = chunk->code[offset + 1];
   uint8_t argCount = chunk->code[offset + 2];
@@ -49,6 +116,28 @@ static int invokeInstruction(const char *name, Chunk *chunk, int offset) {
   return offset + 3;
 }
 
+static int cachedInstruction(const char *name, Chunk *chunk, int offset) {
+  uint8_t constant = chunk->code[offset + 1];
+  uint16_t cache = (uint16_t)(chunk->code[offset + 2] << 8);
+  cache |= chunk->code[offset + 3];
+  printf("%-16s %4d '", name, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("' ic %d\n", cache);
+  return offset + 4;
+}
+
+static int cachedInvokeInstruction(const char *name, Chunk *chunk,
+                                   int offset) {
+  uint8_t constant = chunk->code[offset + 1];
+  uint8_t argCount = chunk->code[offset + 2];
+  uint16_t cache = (uint16_t)(chunk->code[offset + 3] << 8);
+  cache |= chunk->code[offset + 4];
+  printf("%-16s (%d args) %4d '", name, argCount, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("' ic %d\n", cache);
+  return offset + 5;
+}
+
 int disassembleInstruction(Chunk *chunk, int offset) {
   printf("%04d ", offset);
 
@@ -108,6 +197,71 @@ int disassembleInstruction(Chunk *chunk, int offset) {
   case OP_INHERIT:
     return simpleInstruction("OP_INHERIT", offset);
 
+  case OP_ADD_NUM_NUM:
+    return simpleInstruction("OP_ADD_NUM_NUM", offset);
+
+  case OP_ADD_STR_STR:
+    return simpleInstruction("OP_ADD_STR_STR", offset);
+
+  case OP_SUBTRACT_NUM_NUM:
+    return simpleInstruction("OP_SUBTRACT_NUM_NUM", offset);
+
+  case OP_MULTIPLY_NUM_NUM:
+    return simpleInstruction("OP_MULTIPLY_NUM_NUM", offset);
+
+  case OP_DIVIDE_NUM_NUM:
+    return simpleInstruction("OP_DIVIDE_NUM_NUM", offset);
+
+  case OP_GREATER_NUM_NUM:
+    return simpleInstruction("OP_GREATER_NUM_NUM", offset);
+
+  case OP_LESS_NUM_NUM:
+    return simpleInstruction("OP_LESS_NUM_NUM", offset);
+
+  case OP_ADD_LOCAL_LOCAL: {
+    uint8_t a = chunk->code[offset + 1];
+    uint8_t b = chunk->code[offset + 2];
+    printf("%-16s %4d %4d\n", "OP_ADD_LOCAL_LOCAL", a, b);
+    return offset + 3;
+  }
+
+  case OP_ADD_LOCAL_CONST:
+    return localConstInstruction("OP_ADD_LOCAL_CONST", chunk, offset);
+
+  case OP_SUBTRACT_LOCAL_CONST:
+    return localConstInstruction("OP_SUBTRACT_LOCAL_CONST", chunk, offset);
+
+  case OP_LESS_LOCAL_CONST_JUMP:
+    return compareJumpInstruction("OP_LESS_LOCAL_CONST_JUMP", chunk, offset);
+
+  case OP_GREATER_LOCAL_CONST_JUMP:
+    return compareJumpInstruction("OP_GREATER_LOCAL_CONST_JUMP", chunk,
+                                  offset);
+
+  case OP_GET_LOCAL_INST:
+    return localCachedInstruction("OP_GET_LOCAL_INST", chunk, offset);
+
+  case OP_JUMP_IF_FALSE_POP:
+    return jumpInstruction("OP_JUMP_IF_FALSE_POP", 1, chunk, offset);
+
+  case OP_SET_LOCAL_POP:
+    return byteInstruction("OP_SET_LOCAL_POP", chunk, offset);
+
+  case OP_ADD_REG:
+    return registerInstruction("OP_ADD_REG", chunk, offset);
+
+  case OP_SUBTRACT_REG:
+    return registerInstruction("OP_SUBTRACT_REG", chunk, offset);
+
+  case OP_MULTIPLY_REG:
+    return registerInstruction("OP_MULTIPLY_REG", chunk, offset);
+
+  case OP_DIVIDE_REG:
+    return registerInstruction("OP_DIVIDE_REG", chunk, offset);
+
+  case OP_MOVE_REG:
+    return registerInstruction("OP_MOVE_REG", chunk, offset);
+
   case OP_POP:
     return simpleInstruction("OP_POP", offset);
 
@@ -115,13 +269,13 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     return simpleInstruction("OP_CLOSE_UPVALUE", offset);
 
   case OP_DEFINE_GLOBAL:
-    return constInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+    return globalInstruction("OP_DEFINE_GLOBAL", chunk, offset);
 
   case OP_GET_GLOBAL:
-    return constInstruction("OP_GET_GLOBAL", chunk, offset);
+    return globalInstruction("OP_GET_GLOBAL", chunk, offset);
 
   case OP_SET_GLOBAL:
-    return constInstruction("OP_SET_GLOBAL", chunk, offset);
+    return globalInstruction("OP_SET_GLOBAL", chunk, offset);
 
   case OP_GET_LOCAL:
     return byteInstruction("OP_GET_LOCAL", chunk, offset);
@@ -174,13 +328,13 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     return constInstruction("OP_GET_SUPER", chunk, offset);
 
   case OP_GET_INST:
-    return constInstruction("OP_GET_INST", chunk, offset);
+    return cachedInstruction("OP_GET_INST", chunk, offset);
 
   case OP_SET_INST:
-    return constInstruction("OP_SET_INST", chunk, offset);
+    return cachedInstruction("OP_SET_INST", chunk, offset);
 
   case OP_INVOKE:
-    return invokeInstruction("OP_INVOKE", chunk, offset);
+    return cachedInvokeInstruction("OP_INVOKE", chunk, offset);
 
   case OP_INVOKE_SUPER:
     return invokeInstruction("OP_INVOKE_SUPER", chunk, offset);
@@ -190,3 +344,71 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     return offset + 1;
   }
 }
+
+static const char *opcodeNames[] = {
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_NIL] = "OP_NIL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_POP] = "OP_POP",
+    [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+    [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+    [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+    [OP_GET_LOCAL] = "OP_GET_LOCAL",
+    [OP_SET_LOCAL] = "OP_SET_LOCAL",
+    [OP_SET_UPVALUE] = "OP_SET_UPVALUE",
+    [OP_GET_UPVALUE] = "OP_GET_UPVALUE",
+    [OP_CLOSE_UPVALUE] = "OP_CLOSE_UPVALUE",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_LESS] = "OP_LESS",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUBTRACT] = "OP_SUBTRACT",
+    [OP_MULTIPLY] = "OP_MULTIPLY",
+    [OP_DIVIDE] = "OP_DIVIDE",
+    [OP_NOT] = "OP_NOT",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_PRINT] = "OP_PRINT",
+    [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+    [OP_JUMP] = "OP_JUMP",
+    [OP_LOOP] = "OP_LOOP",
+    [OP_RETURN] = "OP_RETURN",
+    [OP_CALL] = "OP_CALL",
+    [OP_CLOSURE] = "OP_CLOSURE",
+    [OP_CLASS] = "OP_CLASS",
+    [OP_METHOD] = "OP_METHOD",
+    [OP_GET_INST] = "OP_GET_INST",
+    [OP_SET_INST] = "OP_SET_INST",
+    [OP_INVOKE] = "OP_INVOKE",
+    [OP_GET_SUPER] = "OP_GET_SUPER",
+    [OP_INVOKE_SUPER] = "OP_INVOKE_SUPER",
+    [OP_INHERIT] = "OP_INHERIT",
+    [OP_ADD_NUM_NUM] = "OP_ADD_NUM_NUM",
+    [OP_ADD_STR_STR] = "OP_ADD_STR_STR",
+    [OP_SUBTRACT_NUM_NUM] = "OP_SUBTRACT_NUM_NUM",
+    [OP_MULTIPLY_NUM_NUM] = "OP_MULTIPLY_NUM_NUM",
+    [OP_DIVIDE_NUM_NUM] = "OP_DIVIDE_NUM_NUM",
+    [OP_GREATER_NUM_NUM] = "OP_GREATER_NUM_NUM",
+    [OP_LESS_NUM_NUM] = "OP_LESS_NUM_NUM",
+    [OP_ADD_LOCAL_LOCAL] = "OP_ADD_LOCAL_LOCAL",
+    [OP_ADD_LOCAL_CONST] = "OP_ADD_LOCAL_CONST",
+    [OP_SUBTRACT_LOCAL_CONST] = "OP_SUBTRACT_LOCAL_CONST",
+    [OP_LESS_LOCAL_CONST_JUMP] = "OP_LESS_LOCAL_CONST_JUMP",
+    [OP_GREATER_LOCAL_CONST_JUMP] = "OP_GREATER_LOCAL_CONST_JUMP",
+    [OP_GET_LOCAL_INST] = "OP_GET_LOCAL_INST",
+    [OP_JUMP_IF_FALSE_POP] = "OP_JUMP_IF_FALSE_POP",
+    [OP_SET_LOCAL_POP] = "OP_SET_LOCAL_POP",
+    [OP_ADD_REG] = "OP_ADD_REG",
+    [OP_SUBTRACT_REG] = "OP_SUBTRACT_REG",
+    [OP_MULTIPLY_REG] = "OP_MULTIPLY_REG",
+    [OP_DIVIDE_REG] = "OP_DIVIDE_REG",
+    [OP_MOVE_REG] = "OP_MOVE_REG",
+};
+
+const char *opcodeName(uint8_t opcode) {
+  if (opcode >= sizeof(opcodeNames) / sizeof(opcodeNames[0]) ||
+      opcodeNames[opcode] == NULL) {
+    return "OP_UNKNOWN";
+  }
+  return opcodeNames[opcode];
+}
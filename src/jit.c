@@ -0,0 +1,672 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../include/jit.h"
+#include "../include/memory.h"
+#include "../include/object.h"
+#include "../include/optimizer.h"
+#include "../include/vm.h"
+
+#ifdef JIT_SUPPORTED
+
+#include <sys/mman.h>
+
+// native code for one function. Entering at entries[offset] runs the
+// bytecode instruction at offset, the code returns the offset the
+// interpreter carries on from once it reaches something it can't run
+struct JitCode {
+  uint8_t *code;
+  size_t size;
+  uint32_t *entries;
+  int entryCount;
+};
+
+typedef int (*JitFn)(Value *slots, Value *stackTop, uint8_t *target,
+                     Value *constants);
+
+// a rel32 operand waiting for the code of a bytecode offset to be placed
+typedef struct {
+  int position;
+  int offset;
+} Fixup;
+
+// while native code runs rbx is vm.stackTop, r12 the frame's slots, r13 its
+// constants and r15 holds QNAN for type checks. rax, rcx, rdx and r11 are
+// scratch
+typedef struct {
+  uint8_t *code;
+  int count;
+  int capacity;
+  Fixup *jumps;
+  int jumpCount;
+  int jumpCapacity;
+  Fixup *exits;
+  int exitCount;
+  int exitCapacity;
+} Assembler;
+
+static Assembler as;
+
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RDI 7
+
+static void emit(uint8_t byte) {
+  if (as.capacity < as.count + 1) {
+    int oldCapacity = as.capacity;
+    as.capacity = GROW_CAPACITY(oldCapacity);
+    as.code = GROW_ARRAY(uint8_t, as.code, oldCapacity, as.capacity);
+  }
+  as.code[as.count++] = byte;
+}
+
+static void emitSequence(const uint8_t *bytes, int count) {
+  for (int i = 0; i < count; i++) {
+    emit(bytes[i]);
+  }
+}
+
+#define EMIT(...)                                                              \
+  emitSequence((const uint8_t[]){__VA_ARGS__},                                 \
+               sizeof((const uint8_t[]){__VA_ARGS__}))
+
+static void emit32(uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    emit((value >> (i * 8)) & 0xff);
+  }
+}
+
+static void emit64(uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    emit((value >> (i * 8)) & 0xff);
+  }
+}
+
+static void patch32(int position, int32_t value) {
+  for (int i = 0; i < 4; i++) {
+    as.code[position + i] = ((uint32_t)value >> (i * 8)) & 0xff;
+  }
+}
+
+static void addFixup(Fixup **fixups, int *count, int *capacity, int offset) {
+  if (*capacity < *count + 1) {
+    int oldCapacity = *capacity;
+    *capacity = GROW_CAPACITY(oldCapacity);
+    *fixups = GROW_ARRAY(Fixup, *fixups, oldCapacity, *capacity);
+  }
+  (*fixups)[*count].position = as.count;
+  (*fixups)[*count].offset = offset;
+  (*count)++;
+}
+
+// rel32 to the native code of a bytecode offset
+static void jumpTo(int offset) {
+  addFixup(&as.jumps, &as.jumpCount, &as.jumpCapacity, offset);
+  emit32(0);
+}
+
+// rel32 to a stub handing offset back to the interpreter
+static void exitTo(int offset) {
+  addFixup(&as.exits, &as.exitCount, &as.exitCapacity, offset);
+  emit32(0);
+}
+
+// forward jump inside one template, patched with patchHere()
+static int jumpForward() {
+  emit32(0);
+  return as.count - 4;
+}
+
+static void patchHere(int position) {
+  patch32(position, as.count - (position + 4));
+}
+
+static void loadStack(int reg, int depth) {
+  EMIT(0x48, 0x8b, 0x43 | reg << 3, (uint8_t)(-8 * depth));
+}
+
+static void storeStack(int reg, int depth) {
+  EMIT(0x48, 0x89, 0x43 | reg << 3, (uint8_t)(-8 * depth));
+}
+
+static void adjustStack(int count) {
+  if (count > 0) {
+    EMIT(0x48, 0x83, 0xc3, (uint8_t)(8 * count));
+  } else if (count < 0) {
+    EMIT(0x48, 0x83, 0xeb, (uint8_t)(-8 * count));
+  }
+}
+
+static void pushRax() {
+  storeStack(RAX, 0);
+  adjustStack(1);
+}
+
+static void loadLocal(int reg, int slot) {
+  EMIT(0x49, 0x8b, 0x84 | reg << 3, 0x24);
+  emit32(slot * sizeof(Value));
+}
+
+static void storeLocal(int reg, int slot) {
+  EMIT(0x49, 0x89, 0x84 | reg << 3, 0x24);
+  emit32(slot * sizeof(Value));
+}
+
+static void loadConstant(int reg, int index) {
+  EMIT(0x49, 0x8b, 0x85 | reg << 3);
+  emit32(index * sizeof(Value));
+}
+
+static void moveImmediate(int reg, uint64_t value) {
+  EMIT(0x48, 0xb8 + reg);
+  emit64(value);
+}
+
+// leaves the instruction at offset to the interpreter unless reg holds a
+// number, nothing has been changed yet at that point
+static void checkNumber(int reg, int offset) {
+  EMIT(0x48, 0x89, 0xc2 | reg << 3); // mov rdx, reg
+  EMIT(0x4c, 0x21, 0xfa);            // and rdx, r15
+  EMIT(0x4c, 0x39, 0xfa);            // cmp rdx, r15
+  EMIT(0x0f, 0x84);                  // je exit
+  exitTo(offset);
+}
+
+// rax = a and rcx = b, both numbers, moved to xmm0 and xmm1
+static void numberOperands(int offset) {
+  checkNumber(RAX, offset);
+  checkNumber(RCX, offset);
+  EMIT(0x66, 0x48, 0x0f, 0x6e, 0xc0); // movq xmm0, rax
+  EMIT(0x66, 0x48, 0x0f, 0x6e, 0xc9); // movq xmm1, rcx
+}
+
+// rax = xmm0 op xmm1
+static void arithmetic(uint8_t op) {
+  uint8_t sse;
+  switch (op) {
+  case OP_ADD:
+    sse = 0x58;
+    break;
+  case OP_SUBTRACT:
+    sse = 0x5c;
+    break;
+  case OP_MULTIPLY:
+    sse = 0x59;
+    break;
+  default:
+    sse = 0x5e;
+    break;
+  }
+  EMIT(0xf2, 0x0f, sse, 0xc1);        // addsd/subsd/mulsd/divsd xmm0, xmm1
+  EMIT(0x66, 0x48, 0x0f, 0x7e, 0xc0); // movq rax, xmm0
+}
+
+// rax = the bool Value of a condition code set by the last instruction
+static void boolFromCondition(uint8_t setcc) {
+  EMIT(0x0f, setcc, 0xc0); // setcc al
+  EMIT(0x0f, 0xb6, 0xc0);  // movzx eax, al
+  moveImmediate(RDX, FALSE_VAL);
+  EMIT(0x48, 0x01, 0xd0); // add rax, rdx
+}
+
+// ucomisd so that "above" means the comparison holds, false for NaN
+static void compare(bool less) {
+  if (less) {
+    EMIT(0x66, 0x0f, 0x2e, 0xc8); // ucomisd xmm1, xmm0
+  } else {
+    EMIT(0x66, 0x0f, 0x2e, 0xc1); // ucomisd xmm0, xmm1
+  }
+}
+
+// jumps to the bytecode offset target if rax is nil or false
+static void jumpIfFalsey(int target) {
+  moveImmediate(RDX, NIL_VAL);
+  EMIT(0x48, 0x39, 0xd0, 0x0f, 0x84); // cmp rax, rdx; je
+  jumpTo(target);
+  moveImmediate(RDX, FALSE_VAL);
+  EMIT(0x48, 0x39, 0xd0, 0x0f, 0x84);
+  jumpTo(target);
+}
+
+// runtime helpers see the stack through vm.stackTop
+static void callHelper(void *function) {
+  moveImmediate(RAX, (uint64_t)(uintptr_t)&vm.stackTop);
+  EMIT(0x48, 0x89, 0x18); // mov [rax], rbx
+  moveImmediate(RAX, (uint64_t)(uintptr_t)function);
+  EMIT(0xff, 0xd0); // call rax
+  moveImmediate(RCX, (uint64_t)(uintptr_t)&vm.stackTop);
+  EMIT(0x48, 0x8b, 0x19); // mov rbx, [rcx]
+}
+
+// r11 = &vm.globals[slot], the array moves as globals are added
+static void loadGlobal(int slot) {
+  EMIT(0x49, 0xbb);
+  emit64((uint64_t)(uintptr_t)&vm.globals);
+  EMIT(0x4d, 0x8b, 0x1b); // mov r11, [r11]
+  EMIT(0x49, 0x81, 0xc3); // add r11, imm32
+  emit32(slot * sizeof(GlobalVar));
+}
+
+static void printHelper(Value value) {
+  printValue(value);
+  printf("\n");
+}
+
+static bool addHelper() {
+  Value b = vm.stackTop[-1];
+  Value a = vm.stackTop[-2];
+  if (!IS_TEXT(a) || !IS_TEXT(b)) return false;
+  concatenate();
+  return true;
+}
+
+static uint16_t readShort(uint8_t *code) {
+  return (uint16_t)((code[0] << 8) | code[1]);
+}
+
+// loads a register instruction operand, a slot or a constant
+static void loadRegister(int reg, bool isConstant, uint8_t index) {
+  if (isConstant) {
+    loadConstant(reg, index);
+  } else {
+    loadLocal(reg, index);
+  }
+}
+
+// emits the template for the instruction at offset, returns false when the
+// instruction is left to the interpreter
+static bool compileInstruction(Chunk *chunk, int offset) {
+  uint8_t *code = &chunk->code[offset];
+  int next = offset + instructionLength(chunk, offset);
+
+  switch (code[0]) {
+  case OP_CONSTANT:
+    loadConstant(RAX, code[1]);
+    pushRax();
+    return true;
+
+  case OP_NIL:
+    moveImmediate(RAX, NIL_VAL);
+    pushRax();
+    return true;
+
+  case OP_TRUE:
+    moveImmediate(RAX, TRUE_VAL);
+    pushRax();
+    return true;
+
+  case OP_FALSE:
+    moveImmediate(RAX, FALSE_VAL);
+    pushRax();
+    return true;
+
+  case OP_POP:
+    adjustStack(-1);
+    return true;
+
+  case OP_GET_LOCAL:
+    loadLocal(RAX, code[1]);
+    pushRax();
+    return true;
+
+  case OP_SET_LOCAL:
+    loadStack(RAX, 1);
+    storeLocal(RAX, code[1]);
+    return true;
+
+  case OP_SET_LOCAL_POP:
+    loadStack(RAX, 1);
+    storeLocal(RAX, code[1]);
+    adjustStack(-1);
+    return true;
+
+  case OP_DEFINE_GLOBAL:
+    loadGlobal(readShort(&code[1]));
+    loadStack(RAX, 1);
+    EMIT(0x49, 0x89, 0x83); // mov [r11 + value], rax
+    emit32(offsetof(GlobalVar, value));
+    EMIT(0x41, 0xc6, 0x83); // mov byte [r11 + isDefined], 1
+    emit32(offsetof(GlobalVar, isDefined));
+    emit(1);
+    adjustStack(-1);
+    return true;
+
+  case OP_GET_GLOBAL:
+  case OP_SET_GLOBAL:
+    loadGlobal(readShort(&code[1]));
+    EMIT(0x41, 0x80, 0xbb); // cmp byte [r11 + isDefined], 0
+    emit32(offsetof(GlobalVar, isDefined));
+    emit(0);
+    EMIT(0x0f, 0x84); // undefined, let the interpreter report it
+    exitTo(offset);
+    if (code[0] == OP_GET_GLOBAL) {
+      EMIT(0x49, 0x8b, 0x83); // mov rax, [r11 + value]
+      emit32(offsetof(GlobalVar, value));
+      pushRax();
+    } else {
+      loadStack(RAX, 1);
+      EMIT(0x49, 0x89, 0x83); // mov [r11 + value], rax
+      emit32(offsetof(GlobalVar, value));
+    }
+    return true;
+
+  case OP_ADD:
+  case OP_ADD_NUM_NUM:
+  case OP_ADD_STR_STR: {
+    loadStack(RAX, 2);
+    loadStack(RCX, 1);
+
+    // numbers inline, strings through concatenate(), the rest is an error
+    // the interpreter reports
+    EMIT(0x48, 0x89, 0xc2, 0x4c, 0x21, 0xfa, 0x4c, 0x39, 0xfa, 0x0f, 0x84);
+    int aNotNumber = jumpForward();
+    EMIT(0x48, 0x89, 0xca, 0x4c, 0x21, 0xfa, 0x4c, 0x39, 0xfa, 0x0f, 0x84);
+    int bNotNumber = jumpForward();
+    EMIT(0x66, 0x48, 0x0f, 0x6e, 0xc0);
+    EMIT(0x66, 0x48, 0x0f, 0x6e, 0xc9);
+    arithmetic(OP_ADD);
+    storeStack(RAX, 2);
+    adjustStack(-1);
+    emit(0xe9);
+    int done = jumpForward();
+
+    patchHere(aNotNumber);
+    patchHere(bNotNumber);
+    callHelper((void *)addHelper);
+    EMIT(0x84, 0xc0, 0x0f, 0x84); // test al, al; je exit
+    exitTo(offset);
+    patchHere(done);
+    return true;
+  }
+
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+  case OP_SUBTRACT_NUM_NUM:
+  case OP_MULTIPLY_NUM_NUM:
+  case OP_DIVIDE_NUM_NUM: {
+    uint8_t op = code[0];
+    if (op == OP_SUBTRACT_NUM_NUM) op = OP_SUBTRACT;
+    if (op == OP_MULTIPLY_NUM_NUM) op = OP_MULTIPLY;
+    if (op == OP_DIVIDE_NUM_NUM) op = OP_DIVIDE;
+
+    loadStack(RAX, 2);
+    loadStack(RCX, 1);
+    numberOperands(offset);
+    arithmetic(op);
+    storeStack(RAX, 2);
+    adjustStack(-1);
+    return true;
+  }
+
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_GREATER_NUM_NUM:
+  case OP_LESS_NUM_NUM:
+    loadStack(RAX, 2);
+    loadStack(RCX, 1);
+    numberOperands(offset);
+    compare(code[0] == OP_LESS || code[0] == OP_LESS_NUM_NUM);
+    boolFromCondition(0x97); // seta
+    storeStack(RAX, 2);
+    adjustStack(-1);
+    return true;
+
+  case OP_EQUAL:
+    // only numbers, equality of other values stays with valuesEqual()
+    loadStack(RAX, 2);
+    loadStack(RCX, 1);
+    numberOperands(offset);
+    EMIT(0x66, 0x0f, 0x2e, 0xc1); // ucomisd xmm0, xmm1
+    EMIT(0x0f, 0x94, 0xc0);       // sete al
+    EMIT(0x0f, 0x9b, 0xc1);       // setnp cl
+    EMIT(0x20, 0xc8);             // and al, cl
+    EMIT(0x0f, 0xb6, 0xc0);       // movzx eax, al
+    moveImmediate(RDX, FALSE_VAL);
+    EMIT(0x48, 0x01, 0xd0);
+    storeStack(RAX, 2);
+    adjustStack(-1);
+    return true;
+
+  case OP_NOT:
+    loadStack(RAX, 1);
+    moveImmediate(RDX, NIL_VAL);
+    EMIT(0x48, 0x39, 0xd0, 0x0f, 0x94, 0xc1); // cmp rax, rdx; sete cl
+    moveImmediate(RDX, FALSE_VAL);
+    EMIT(0x48, 0x39, 0xd0, 0x0f, 0x94, 0xc0); // cmp rax, rdx; sete al
+    EMIT(0x08, 0xc8);                         // or al, cl
+    EMIT(0x0f, 0xb6, 0xc0);
+    moveImmediate(RDX, FALSE_VAL);
+    EMIT(0x48, 0x01, 0xd0);
+    storeStack(RAX, 1);
+    return true;
+
+  case OP_NEGATE:
+    loadStack(RAX, 1);
+    checkNumber(RAX, offset);
+    moveImmediate(RDX, SIGN_BIT);
+    EMIT(0x48, 0x31, 0xd0); // xor rax, rdx
+    storeStack(RAX, 1);
+    return true;
+
+  case OP_PRINT:
+    EMIT(0x48, 0x8b, 0x7b, 0xf8); // mov rdi, [rbx - 8]
+    adjustStack(-1);
+    callHelper((void *)printHelper);
+    return true;
+
+  case OP_JUMP:
+    emit(0xe9);
+    jumpTo(next + readShort(&code[1]));
+    return true;
+
+  case OP_LOOP:
+    emit(0xe9);
+    jumpTo(next - readShort(&code[1]));
+    return true;
+
+  case OP_JUMP_IF_FALSE:
+    loadStack(RAX, 1);
+    jumpIfFalsey(next + readShort(&code[1]));
+    return true;
+
+  case OP_JUMP_IF_FALSE_POP:
+    loadStack(RAX, 1);
+    jumpIfFalsey(next + readShort(&code[1]));
+    adjustStack(-1);
+    return true;
+
+  case OP_ADD_LOCAL_LOCAL:
+  case OP_ADD_LOCAL_CONST:
+  case OP_SUBTRACT_LOCAL_CONST:
+    loadLocal(RAX, code[1]);
+    if (code[0] == OP_ADD_LOCAL_LOCAL) {
+      loadLocal(RCX, code[2]);
+    } else {
+      loadConstant(RCX, code[2]);
+    }
+    numberOperands(offset);
+    arithmetic(code[0] == OP_SUBTRACT_LOCAL_CONST ? OP_SUBTRACT : OP_ADD);
+    pushRax();
+    return true;
+
+  case OP_LESS_LOCAL_CONST_JUMP:
+  case OP_GREATER_LOCAL_CONST_JUMP: {
+    loadLocal(RAX, code[1]);
+    loadConstant(RCX, code[2]);
+    numberOperands(offset);
+    compare(code[0] == OP_LESS_LOCAL_CONST_JUMP);
+    EMIT(0x0f, 0x87); // ja, the condition holds
+    int holds = jumpForward();
+    moveImmediate(RAX, FALSE_VAL);
+    pushRax();
+    emit(0xe9);
+    jumpTo(next + readShort(&code[3]));
+    patchHere(holds);
+    return true;
+  }
+
+  case OP_ADD_REG:
+  case OP_SUBTRACT_REG:
+  case OP_MULTIPLY_REG:
+  case OP_DIVIDE_REG: {
+    static const uint8_t stackOps[] = {OP_ADD, OP_SUBTRACT, OP_MULTIPLY,
+                                       OP_DIVIDE};
+    loadRegister(RAX, code[2] & REGISTER_A_CONSTANT, code[3]);
+    loadRegister(RCX, code[2] & REGISTER_B_CONSTANT, code[4]);
+    numberOperands(offset);
+    arithmetic(stackOps[code[0] - OP_ADD_REG]);
+    storeLocal(RAX, code[1]);
+    return true;
+  }
+
+  case OP_MOVE_REG:
+    loadRegister(RAX, code[2] & REGISTER_A_CONSTANT, code[3]);
+    storeLocal(RAX, code[1]);
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+static void freeAssembler() {
+  FREE_ARRAY(uint8_t, as.code, as.capacity);
+  FREE_ARRAY(Fixup, as.jumps, as.jumpCapacity);
+  FREE_ARRAY(Fixup, as.exits, as.exitCapacity);
+  memset(&as, 0, sizeof(as));
+}
+
+bool jitCompile(ObjFunction *function) {
+  Chunk *chunk = &function->chunk;
+  function->jitFailed = true;
+
+  memset(&as, 0, sizeof(as));
+  uint32_t *entries = ALLOCATE(uint32_t, chunk->count + 1);
+  int *exitStubs = ALLOCATE(int, chunk->count + 1);
+  for (int i = 0; i <= chunk->count; i++) {
+    entries[i] = 0;
+    exitStubs[i] = -1;
+  }
+
+  // prologue, called as fn(slots, stackTop, target, constants)
+  EMIT(0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57);
+  EMIT(0x49, 0x89, 0xfc); // mov r12, rdi
+  EMIT(0x48, 0x89, 0xf3); // mov rbx, rsi
+  EMIT(0x49, 0x89, 0xcd); // mov r13, rcx
+  EMIT(0x49, 0xbf);       // mov r15, QNAN
+  emit64(QNAN);
+  EMIT(0xff, 0xe2); // jmp rdx
+
+  for (int offset = 0; offset < chunk->count;
+       offset += instructionLength(chunk, offset)) {
+    entries[offset] = as.count;
+    if (!compileInstruction(chunk, offset)) {
+      exitStubs[offset] = as.count;
+      emit(0xb8); // mov eax, offset
+      emit32(offset);
+      emit(0xe9);
+      addFixup(&as.exits, &as.exitCount, &as.exitCapacity, -1);
+      emit32(0);
+    }
+  }
+  entries[chunk->count] = as.count;
+
+  // every other exit goes through one stub per offset
+  for (int i = 0; i < as.exitCount; i++) {
+    int offset = as.exits[i].offset;
+    if (offset == -1) continue;
+    if (exitStubs[offset] == -1) {
+      exitStubs[offset] = as.count;
+      emit(0xb8);
+      emit32(offset);
+      emit(0xe9);
+      addFixup(&as.exits, &as.exitCount, &as.exitCapacity, -1);
+      emit32(0);
+    }
+    patch32(as.exits[i].position, exitStubs[offset] - (as.exits[i].position + 4));
+  }
+
+  // epilogue, hands the stack back and returns the offset in eax
+  int epilogue = as.count;
+  moveImmediate(RCX, (uint64_t)(uintptr_t)&vm.stackTop);
+  EMIT(0x48, 0x89, 0x19); // mov [rcx], rbx
+  EMIT(0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3);
+
+  for (int i = 0; i < as.exitCount; i++) {
+    if (as.exits[i].offset != -1) continue;
+    int position = as.exits[i].position;
+    patch32(position, epilogue - (position + 4));
+  }
+  for (int i = 0; i < as.jumpCount; i++) {
+    int position = as.jumps[i].position;
+    patch32(position, entries[as.jumps[i].offset] - (position + 4));
+  }
+
+  FREE_ARRAY(int, exitStubs, chunk->count + 1);
+
+  size_t page = 4096;
+  size_t size = ((size_t)as.count + page - 1) / page * page;
+  uint8_t *code = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) {
+    FREE_ARRAY(uint32_t, entries, chunk->count + 1);
+    freeAssembler();
+    return false;
+  }
+  memcpy(code, as.code, as.count);
+  if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(code, size);
+    FREE_ARRAY(uint32_t, entries, chunk->count + 1);
+    freeAssembler();
+    return false;
+  }
+  freeAssembler();
+
+  JitCode *jit = ALLOCATE(JitCode, 1);
+  jit->code = code;
+  jit->size = size;
+  jit->entries = entries;
+  jit->entryCount = chunk->count + 1;
+  function->jit = jit;
+  function->jitFailed = false;
+  return true;
+}
+
+uint8_t *jitEnter(ObjFunction *function, Value *slots, uint8_t *ip) {
+  JitCode *jit = function->jit;
+  Chunk *chunk = &function->chunk;
+  int offset = (int)(ip - chunk->code);
+
+  JitFn fn = (JitFn)(void *)jit->code;
+  int resume = fn(slots, vm.stackTop, jit->code + jit->entries[offset],
+                  chunk->constants.values);
+  return chunk->code + resume;
+}
+
+void jitFree(JitCode *jit) {
+  if (jit == NULL) return;
+  munmap(jit->code, jit->size);
+  FREE_ARRAY(uint32_t, jit->entries, jit->entryCount);
+  FREE(JitCode, jit);
+}
+
+#else
+
+bool jitCompile(ObjFunction *function) {
+  function->jitFailed = true;
+  return false;
+}
+
+uint8_t *jitEnter(ObjFunction *function, Value *slots, uint8_t *ip) {
+  (void)function;
+  (void)slots;
+  return ip;
+}
+
+void jitFree(JitCode *jit) { (void)jit; }
+
+#endif
@@ -0,0 +1,579 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/chunk.h"
+#include "../include/debug.h"
+#include "../include/loxc.h"
+#include "../include/memory.h"
+#include "../include/object.h"
+#include "../include/optimizer.h"
+#include "../include/vm.h"
+
+// a .loxc file is an image of the compiled script in four parts:
+//
+//   header    magic, version, flags, source hash and where the sections are
+//   metadata  the names of the global slots the code was compiled against,
+//             then the script function with every nested function inlined
+//             in its constants
+//   code      every function's bytecode back to back, page aligned
+//   lines     every function's line table as native ints, page aligned
+//
+// The file is mapped and chunks point straight into the code and lines
+// sections, only the constants are rebuilt as objects. The mapping is
+// private so quickening rewrites copy the pages it touches and everything
+// else stays shared between processes running the same script. Integers
+// outside the line tables are little endian
+#define LOXC_MAGIC "LOXC"
+// bump whenever the instruction set or the layout above changes
+#define LOXC_VERSION 2
+
+#define LOXC_REGISTER_CODE 0x01
+#define LOXC_NO_NAME UINT32_MAX
+// the line tables are only usable by a machine that lays ints out the same
+#define LOXC_BYTE_ORDER 0x01020304
+
+typedef enum {
+  CONSTANT_NIL,
+  CONSTANT_FALSE,
+  CONSTANT_TRUE,
+  CONSTANT_NUMBER,
+  CONSTANT_STRING,
+  CONSTANT_FUNCTION,
+} ConstantTag;
+
+typedef struct {
+  uint8_t *bytes;
+  size_t count;
+  size_t capacity;
+} Buffer;
+
+typedef struct {
+  Buffer metadata;
+  Buffer code;
+  Buffer lines;
+  bool failed;
+} Writer;
+
+typedef struct {
+  uint8_t *bytes;
+  size_t length;
+  size_t position;
+  bool failed;
+  Buffer code;
+  Buffer lines;
+  // global slot in the cache -> global slot in this VM
+  int *slots;
+  int slotCount;
+} Reader;
+
+// a mapped file loaded chunks borrow their code from, it lives until the VM
+// is freed
+typedef struct Image {
+  void *base;
+  size_t size;
+  struct Image *next;
+} Image;
+
+static Image *images = NULL;
+
+// 64 bit FNV-1a of the source the cache was compiled from
+static uint64_t hashSource(const char *source) {
+  uint64_t hash = 14695981039346656037u;
+  for (const char *c = source; *c != '\0'; c++) {
+    hash ^= (uint8_t)*c;
+    hash *= 1099511628211u;
+  }
+  return hash;
+}
+
+static uint32_t cacheFlags() {
+  return vm.registerCode ? LOXC_REGISTER_CODE : 0;
+}
+
+static size_t alignToPage(size_t offset) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  return (offset + page - 1) / page * page;
+}
+
+char *bytecodeCachePath(const char *sourcePath) {
+  size_t length = strlen(sourcePath);
+  char *path = malloc(length + 6);
+  if (path == NULL) return NULL;
+
+  memcpy(path, sourcePath, length + 1);
+  if (length >= 4 && strcmp(sourcePath + length - 4, ".lox") == 0) {
+    strcat(path, "c");
+  } else {
+    strcat(path, ".loxc");
+  }
+  return path;
+}
+
+static void writeBytes(Writer *writer, Buffer *buffer, const void *bytes,
+                       size_t length) {
+  if (writer->failed) return;
+
+  if (buffer->capacity < buffer->count + length) {
+    size_t capacity = buffer->capacity < 256 ? 256 : buffer->capacity;
+    while (capacity < buffer->count + length) capacity *= 2;
+
+    uint8_t *grown = realloc(buffer->bytes, capacity);
+    if (grown == NULL) {
+      writer->failed = true;
+      return;
+    }
+    buffer->bytes = grown;
+    buffer->capacity = capacity;
+  }
+
+  memcpy(buffer->bytes + buffer->count, bytes, length);
+  buffer->count += length;
+}
+
+static void writeU32(Writer *writer, Buffer *buffer, uint32_t value) {
+  uint8_t bytes[4];
+  for (int i = 0; i < 4; i++) {
+    bytes[i] = (value >> (i * 8)) & 0xff;
+  }
+  writeBytes(writer, buffer, bytes, 4);
+}
+
+static void writeU64(Writer *writer, Buffer *buffer, uint64_t value) {
+  uint8_t bytes[8];
+  for (int i = 0; i < 8; i++) {
+    bytes[i] = (value >> (i * 8)) & 0xff;
+  }
+  writeBytes(writer, buffer, bytes, 8);
+}
+
+static void writeString(Writer *writer, ObjString *string) {
+  if (string == NULL) {
+    writeU32(writer, &writer->metadata, LOXC_NO_NAME);
+    return;
+  }
+  writeU32(writer, &writer->metadata, (uint32_t)string->length);
+  writeBytes(writer, &writer->metadata, string->chars, string->length);
+}
+
+static void writeFunction(Writer *writer, ObjFunction *function);
+
+static void writeConstant(Writer *writer, Value value) {
+  uint8_t tag;
+  if (IS_NIL(value)) {
+    tag = CONSTANT_NIL;
+  } else if (IS_BOOL(value)) {
+    tag = AS_BOOL(value) ? CONSTANT_TRUE : CONSTANT_FALSE;
+  } else if (IS_NUMBER(value)) {
+    tag = CONSTANT_NUMBER;
+  } else if (IS_STRING(value)) {
+    tag = CONSTANT_STRING;
+  } else if (IS_FUNCTION(value)) {
+    tag = CONSTANT_FUNCTION;
+  } else {
+    // the compiler never puts anything else in a constant pool
+    writer->failed = true;
+    return;
+  }
+
+  writeBytes(writer, &writer->metadata, &tag, 1);
+  switch (tag) {
+  case CONSTANT_NUMBER: {
+    double number = AS_NUMBER(value);
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    writeU64(writer, &writer->metadata, bits);
+    break;
+  }
+  case CONSTANT_STRING:
+    writeString(writer, AS_STRING(value));
+    break;
+  case CONSTANT_FUNCTION:
+    writeFunction(writer, AS_FUNCTION(value));
+    break;
+  default:
+    break;
+  }
+}
+
+static void writeFunction(Writer *writer, ObjFunction *function) {
+  Chunk *chunk = &function->chunk;
+  Buffer *metadata = &writer->metadata;
+
+  writeString(writer, function->name);
+  writeU32(writer, metadata, (uint32_t)function->arity);
+  writeU32(writer, metadata, (uint32_t)function->upvalueCount);
+
+  writeU32(writer, metadata, (uint32_t)chunk->count);
+  writeU64(writer, metadata, writer->code.count);
+  writeU64(writer, metadata, writer->lines.count);
+  writeBytes(writer, &writer->code, chunk->code, chunk->count);
+  writeBytes(writer, &writer->lines, chunk->lines,
+             sizeof(int) * chunk->count);
+
+  writeU32(writer, metadata, (uint32_t)chunk->cacheCount);
+  writeU32(writer, metadata, (uint32_t)chunk->constants.count);
+  for (int i = 0; i < chunk->constants.count; i++) {
+    writeConstant(writer, chunk->constants.values[i]);
+  }
+}
+
+// pads the file with zeroes up to start and writes the section there
+static bool writeSection(FILE *file, Buffer *buffer, size_t *offset,
+                         size_t start) {
+  for (; *offset < start; (*offset)++) {
+    if (fputc(0, file) == EOF) return false;
+  }
+  if (fwrite(buffer->bytes, 1, buffer->count, file) != buffer->count) {
+    return false;
+  }
+  *offset += buffer->count;
+  return true;
+}
+
+// writes the freshly compiled script next to its source, the cache is only
+// an optimization so any failure just leaves no file behind. The file is
+// written under a temporary name and renamed so concurrent runs never map
+// half of one
+bool writeBytecodeCache(const char *path, ObjFunction *function,
+                        const char *source) {
+  char temporary[4096];
+  int length =
+      snprintf(temporary, sizeof(temporary), "%s.%d.tmp", path, getpid());
+  if (length < 0 || length >= (int)sizeof(temporary)) return false;
+
+  Writer writer = {{NULL, 0, 0}, {NULL, 0, 0}, {NULL, 0, 0}, false};
+  writeU32(&writer, &writer.metadata, (uint32_t)vm.globalCount);
+  for (int i = 0; i < vm.globalCount; i++) {
+    writeString(&writer, vm.globals[i].name);
+  }
+  writeFunction(&writer, function);
+
+  Buffer header = {NULL, 0, 0};
+  int byteOrder = LOXC_BYTE_ORDER;
+  size_t headerSize = 4 + 4 + 4 + 4 + sizeof(int) + 8 + 4 * 8;
+  size_t codeStart = alignToPage(headerSize + writer.metadata.count);
+  size_t linesStart = alignToPage(codeStart + writer.code.count);
+
+  writeBytes(&writer, &header, LOXC_MAGIC, 4);
+  writeU32(&writer, &header, LOXC_VERSION);
+  writeU32(&writer, &header, cacheFlags());
+  writeU32(&writer, &header, sizeof(int));
+  writeBytes(&writer, &header, &byteOrder, sizeof(int));
+  writeU64(&writer, &header, hashSource(source));
+  writeU64(&writer, &header, codeStart);
+  writeU64(&writer, &header, writer.code.count);
+  writeU64(&writer, &header, linesStart);
+  writeU64(&writer, &header, writer.lines.count);
+
+  bool written = false;
+  FILE *file = writer.failed ? NULL : fopen(temporary, "wb");
+  if (file != NULL) {
+    size_t offset = 0;
+    written = writeSection(file, &header, &offset, 0) &&
+              writeSection(file, &writer.metadata, &offset, offset) &&
+              writeSection(file, &writer.code, &offset, codeStart) &&
+              writeSection(file, &writer.lines, &offset, linesStart);
+    if (fclose(file) != 0) written = false;
+    if (!written || rename(temporary, path) != 0) {
+      remove(temporary);
+      written = false;
+    }
+  }
+
+  free(header.bytes);
+  free(writer.metadata.bytes);
+  free(writer.code.bytes);
+  free(writer.lines.bytes);
+  return written;
+}
+
+static uint8_t *readBytes(Reader *reader, size_t length) {
+  if (reader->failed || reader->length - reader->position < length) {
+    reader->failed = true;
+    return NULL;
+  }
+  uint8_t *bytes = reader->bytes + reader->position;
+  reader->position += length;
+  return bytes;
+}
+
+static uint32_t readU32(Reader *reader) {
+  const uint8_t *bytes = readBytes(reader, 4);
+  if (bytes == NULL) return 0;
+
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    value |= (uint32_t)bytes[i] << (i * 8);
+  }
+  return value;
+}
+
+static uint64_t readU64(Reader *reader) {
+  const uint8_t *bytes = readBytes(reader, 8);
+  if (bytes == NULL) return 0;
+
+  uint64_t value = 0;
+  for (int i = 0; i < 8; i++) {
+    value |= (uint64_t)bytes[i] << (i * 8);
+  }
+  return value;
+}
+
+static bool readSection(Reader *reader, Buffer *section) {
+  uint64_t start = readU64(reader);
+  uint64_t size = readU64(reader);
+  if (reader->failed || start > reader->length ||
+      size > reader->length - start) {
+    reader->failed = true;
+    return false;
+  }
+  section->bytes = reader->bytes + start;
+  section->count = size;
+  return true;
+}
+
+// NULL for a missing function name as well as on failure
+static ObjString *readString(Reader *reader) {
+  uint32_t length = readU32(reader);
+  if (reader->failed || length == LOXC_NO_NAME) return NULL;
+
+  const uint8_t *chars = readBytes(reader, length);
+  if (chars == NULL) return NULL;
+  return copyString((const char *)chars, (int)length);
+}
+
+// points the global instructions of code read from a file at this VM's
+// slots, slots[i] is the slot for the file's slot i. The walk also checks
+// the code decodes into whole instructions. Slots normally line up with the
+// VM that wrote the file and operands are only rewritten, copying their
+// page of a mapped image, when they don't. Other operands are trusted,
+// files are only ever written by clox itself
+bool relocateGlobals(Chunk *chunk, const int *slots, int slotCount) {
+  for (int offset = 0; offset < chunk->count;) {
+    uint8_t op = chunk->code[offset];
+    if (strcmp(opcodeName(op), "OP_UNKNOWN") == 0) {
+      return false;
+    }
+    if (op == OP_CLOSURE) {
+      if (offset + 1 >= chunk->count ||
+          chunk->code[offset + 1] >= chunk->constants.count ||
+          !IS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]])) {
+        return false;
+      }
+    }
+
+    int length = instructionLength(chunk, offset);
+    if (offset + length > chunk->count) {
+      return false;
+    }
+
+    if (op == OP_DEFINE_GLOBAL || op == OP_GET_GLOBAL ||
+        op == OP_SET_GLOBAL) {
+      int cached = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+      if (cached >= slotCount) {
+        return false;
+      }
+      int slot = slots[cached];
+      if (slot != cached) {
+        chunk->code[offset + 1] = (slot >> 8) & 0xff;
+        chunk->code[offset + 2] = slot & 0xff;
+      }
+    }
+    offset += length;
+  }
+  return true;
+}
+
+static ObjFunction *readFunction(Reader *reader);
+
+static Value readConstant(Reader *reader) {
+  const uint8_t *tag = readBytes(reader, 1);
+  if (tag == NULL) return NIL_VAL;
+
+  switch (*tag) {
+  case CONSTANT_NIL:
+    return NIL_VAL;
+  case CONSTANT_FALSE:
+    return BOOL_VAL(false);
+  case CONSTANT_TRUE:
+    return BOOL_VAL(true);
+  case CONSTANT_NUMBER: {
+    uint64_t bits = readU64(reader);
+    double number;
+    memcpy(&number, &bits, sizeof(number));
+    return NUMBER_VAL(number);
+  }
+  case CONSTANT_STRING: {
+    ObjString *string = readString(reader);
+    if (string == NULL) {
+      reader->failed = true;
+      return NIL_VAL;
+    }
+    return OBJ_VAL(string);
+  }
+  case CONSTANT_FUNCTION: {
+    ObjFunction *function = readFunction(reader);
+    return function == NULL ? NIL_VAL : OBJ_VAL(function);
+  }
+  default:
+    reader->failed = true;
+    return NIL_VAL;
+  }
+}
+
+// the function stays on the stack while it is filled in, everything it
+// allocates is reachable from it. On failure the caller resets the stack
+static ObjFunction *readFunction(Reader *reader) {
+  ObjFunction *function = newFunction();
+  push(OBJ_VAL(function));
+  Chunk *chunk = &function->chunk;
+
+  function->name = readString(reader);
+  writeBarrier((Obj *)function, (Obj *)function->name);
+  function->arity = (int)readU32(reader);
+  function->upvalueCount = (int)readU32(reader);
+
+  uint32_t count = readU32(reader);
+  uint64_t codeOffset = readU64(reader);
+  uint64_t linesOffset = readU64(reader);
+  if (reader->failed || count > INT32_MAX / sizeof(int) ||
+      codeOffset > reader->code.count ||
+      count > reader->code.count - codeOffset ||
+      linesOffset % sizeof(int) != 0 || linesOffset > reader->lines.count ||
+      sizeof(int) * count > reader->lines.count - linesOffset) {
+    reader->failed = true;
+    return NULL;
+  }
+
+  chunk->code = reader->code.bytes + codeOffset;
+  chunk->lines = (int *)(reader->lines.bytes + linesOffset);
+  chunk->borrowed = true;
+  chunk->capacity = (int)count;
+  chunk->count = (int)count;
+
+  uint32_t cacheCount = readU32(reader);
+  uint32_t constantCount = readU32(reader);
+  if (reader->failed || cacheCount > UINT16_MAX + 1 ||
+      constantCount > UINT8_COUNT) {
+    reader->failed = true;
+    return NULL;
+  }
+
+  for (uint32_t i = 0; i < constantCount; i++) {
+    Value constant = readConstant(reader);
+    if (reader->failed) return NULL;
+    addConstant(chunk, constant);
+    writeBarrierValue((Obj *)function, constant);
+  }
+
+  // inline caches start out empty, they point at this process' shapes
+  for (uint32_t i = 0; i < cacheCount; i++) {
+    addInlineCache(chunk);
+  }
+
+  if (!relocateGlobals(chunk, reader->slots, reader->slotCount)) {
+    reader->failed = true;
+    return NULL;
+  }
+
+  pop();
+  return function;
+}
+
+static bool readHeader(Reader *reader, const char *source) {
+  int byteOrder = LOXC_BYTE_ORDER;
+  const uint8_t *magic = readBytes(reader, 4);
+  if (magic == NULL || memcmp(magic, LOXC_MAGIC, 4) != 0 ||
+      readU32(reader) != LOXC_VERSION || readU32(reader) != cacheFlags() ||
+      readU32(reader) != sizeof(int)) {
+    return false;
+  }
+
+  const uint8_t *order = readBytes(reader, sizeof(int));
+  if (order == NULL || memcmp(order, &byteOrder, sizeof(int)) != 0 ||
+      readU64(reader) != hashSource(source)) {
+    return false;
+  }
+
+  return readSection(reader, &reader->code) &&
+         readSection(reader, &reader->lines) &&
+         (uintptr_t)reader->lines.bytes % sizeof(int) == 0;
+}
+
+// the script function cached at path, or NULL when there is no cache or it
+// was compiled from different source, flags or a different clox
+ObjFunction *readBytecodeCache(const char *path, const char *source) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+
+  struct stat status;
+  if (fstat(fd, &status) != 0 || status.st_size <= 0) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t size = (size_t)status.st_size;
+  void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return NULL;
+
+  Reader reader = {base, size, 0, false, {NULL, 0, 0}, {NULL, 0, 0}, NULL, 0};
+  if (!readHeader(&reader, source)) {
+    munmap(base, size);
+    return NULL;
+  }
+
+  Value *stackTop = vm.stackTop;
+  ObjFunction *function = NULL;
+  uint32_t slotCount = readU32(&reader);
+  if (!reader.failed && slotCount <= UINT16_MAX + 1) {
+    reader.slots = malloc(sizeof(int) * (slotCount + 1));
+    reader.slotCount = (int)slotCount;
+    for (uint32_t i = 0; reader.slots != NULL && i < slotCount; i++) {
+      ObjString *name = readString(&reader);
+      if (name == NULL) {
+        reader.failed = true;
+        break;
+      }
+      reader.slots[i] = globalSlot(name);
+    }
+
+    if (reader.slots != NULL && !reader.failed) {
+      function = readFunction(&reader);
+    }
+  }
+  vm.stackTop = stackTop;
+  free(reader.slots);
+
+  // functions read before a failure are garbage that never runs, freeing
+  // them leaves their borrowed code alone so the image can go right away
+  Image *image = NULL;
+  if (function != NULL && !reader.failed) {
+    image = malloc(sizeof(Image));
+  }
+  if (image == NULL) {
+    munmap(base, size);
+    return NULL;
+  }
+
+  image->base = base;
+  image->size = size;
+  image->next = images;
+  images = image;
+  return function;
+}
+
+void freeBytecodeImages() {
+  while (images != NULL) {
+    Image *next = images->next;
+    munmap(images->base, images->size);
+    free(images);
+    images = next;
+  }
+}
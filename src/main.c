@@ -1,8 +1,12 @@
+#include "../include/compiler.h"
+#include "../include/loxc.h"
+#include "../include/snapshot.h"
 #include "../include/vm.h"
 
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static void repl() {
   char line[1024];
@@ -43,10 +47,35 @@ static char *readFile(const char *path) {
   return buffer;
 }
 
+static bool useCache = true;
+
+// a warm start runs the .loxc next to the script and skips the compiler
+static ObjFunction *loadFile(const char *path, const char *source) {
+  char *cachePath = useCache ? bytecodeCachePath(path) : NULL;
+  ObjFunction *function = NULL;
+
+  if (cachePath != NULL) {
+    function = readBytecodeCache(cachePath, source);
+  }
+  if (function == NULL) {
+    function = compile(source);
+    if (function != NULL && cachePath != NULL) {
+      writeBytecodeCache(cachePath, function, source);
+    }
+  }
+
+  free(cachePath);
+  return function;
+}
+
 static void runFile(const char *path) {
   char *source = readFile(path);
-  InterpretResult result = interpret(source);
+  ObjFunction *function = loadFile(path, source);
   free(source);
+  if (function == NULL)
+    exit(65);
+
+  InterpretResult result = interpretFunction(function);
 
   if (result == INTERPRET_COMPILE_ERROR)
     exit(65);
@@ -57,12 +86,52 @@ static void runFile(const char *path) {
 int main(int argc, const char *argv[]) {
   initVM();
 
-  if (argc == 1) {
-    repl();
-  } else if (argc == 2) {
-    runFile(argv[1]);
+  const char *path = NULL;
+  const char *restorePath = NULL;
+  const char *snapshotPath = NULL;
+  bool usage = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--registers") == 0) {
+      vm.registerCode = true;
+    } else if (strcmp(argv[i], "--no-jit") == 0) {
+      vm.jitEnabled = false;
+    } else if (strcmp(argv[i], "--no-cache") == 0) {
+      useCache = false;
+    } else if (strcmp(argv[i], "--gc-budget") == 0 && i + 1 < argc) {
+      vm.gcSliceBudget = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+      restorePath = argv[++i];
+    } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+      snapshotPath = argv[++i];
+    } else if (argv[i][0] == '-' || path != NULL) {
+      usage = true;
+    } else {
+      path = argv[i];
+    }
+  }
+
+  if (usage) {
+    fprintf(stderr, "Usage: clox [--registers] [--no-jit] [--no-cache] "
+                    "[--gc-budget objects] [--restore snapshot] "
+                    "[--snapshot snapshot] [path]\n");
   } else {
-    fprintf(stderr, "Usage: clox [path]\n");
+    // the restored heap is in place before the script compiles against it,
+    // the snapshot is taken once the script has run
+    if (restorePath != NULL && !restoreSnapshot(restorePath)) {
+      fprintf(stderr, "Could not restore snapshot %s\n", restorePath);
+      exit(74);
+    }
+
+    if (path == NULL) {
+      repl();
+    } else {
+      runFile(path);
+    }
+
+    if (snapshotPath != NULL && !saveSnapshot(snapshotPath)) {
+      fprintf(stderr, "Could not write snapshot %s\n", snapshotPath);
+      exit(74);
+    }
   }
 
   // Chunk chunk;
@@ -1,9 +1,13 @@
+#include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "../include/compiler.h"
+#include "../include/jit.h"
 #include "../include/memory.h"
 #include "../include/object.h"
+#include "../include/snapshot.h"
 #include "../include/vm.h"
 
 #ifdef DEBUG_LOG_GC
@@ -11,9 +15,86 @@
 #include <stdio.h>
 #endif
 
-#define GC_HEAP_GROWTH_FACTOR 2
+// pooled blocks are poisoned while free so sanitizer builds still catch
+// objects used after they were swept
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#define POISON_BLOCK(block, size) ASAN_POISON_MEMORY_REGION(block, size)
+#define UNPOISON_BLOCK(block, size) ASAN_UNPOISON_MEMORY_REGION(block, size)
+#else
+#define POISON_BLOCK(block, size) ((void)(block), (void)(size))
+#define UNPOISON_BLOCK(block, size) ((void)(block), (void)(size))
+#endif
 
-void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
+#define GC_HEAP_GROWTH_FACTOR 2
+// bytes allocated between minor collections
+#define GC_NURSERY_SIZE (256 * 1024)
+// bytes allocated between the slices of an incremental major collection
+#define GC_SLICE_SIZE (32 * 1024)
+
+// objects are carved out of pages of one size class each, every class a
+// multiple of the granule. Anything larger goes straight to malloc. Pages
+// are aligned to their size so a block finds its page by masking
+#define POOL_GRANULE 16
+#define POOL_CLASS_COUNT 8
+#define POOL_MAX_SIZE (POOL_GRANULE * POOL_CLASS_COUNT)
+#define POOL_PAGE_SIZE (64 * 1024)
+// empty pages kept for any class to reuse, the rest go back to malloc.
+// Young garbage empties whole pages at every minor collection, so about
+// two nurseries' worth are kept
+#define POOL_EMPTY_PAGES_MAX (2 * GC_NURSERY_SIZE / POOL_PAGE_SIZE)
+
+typedef struct PoolBlock {
+  struct PoolBlock *next;
+} PoolBlock;
+
+// every page sits on one list: its class's pages with room, its class's
+// full pages or the empty pages
+typedef struct PoolPage {
+  struct PoolPage *next;
+  struct PoolPage *prev;
+  PoolBlock *freeBlocks;
+  // the never used rest of the page
+  uint8_t *bump;
+  int live;
+  int sizeClass;
+} PoolPage;
+
+#define POOL_PAGE_HEADER                                                       \
+  ((sizeof(PoolPage) + POOL_GRANULE - 1) / POOL_GRANULE * POOL_GRANULE)
+
+typedef struct {
+  PoolPage *available[POOL_CLASS_COUNT];
+  PoolPage *full[POOL_CLASS_COUNT];
+  PoolPage *empty;
+  int emptyCount;
+} Pool;
+
+static Pool pool;
+
+// dead objects are freed on a background thread while the program keeps
+// running. It only ever touches objects nothing can reach anymore and the
+// old generation list it was handed, which is relinked at the next join
+typedef struct {
+  pthread_t thread;
+  bool running;
+  bool threaded;
+  bool major;
+  Obj *garbage;
+  Obj *objects;
+  Obj *survivors;
+  Obj *survivorsTail;
+  size_t freedBytes;
+  // pooled blocks freed by the sweeper, given back to their pages at the
+  // join
+  PoolBlock *freed;
+} Sweeper;
+
+static Sweeper sweeper;
+// set on the sweeper thread, whose frees are counted apart from the VM's
+static _Thread_local bool onSweeper = false;
+
+static void countAllocation(size_t oldSize, size_t newSize) {
   vm.bytesAllocated += newSize - oldSize;
   if (newSize > oldSize) {
 #ifdef DEBUG_STRESS_GC
@@ -23,7 +104,16 @@ void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
       collectGarbage();
     }
   }
+}
+
+void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
+  if (onSweeper) {
+    sweeper.freedBytes += oldSize;
+    free(pointer);
+    return NULL;
+  }
 
+  countAllocation(oldSize, newSize);
   if (newSize == 0) {
     free(pointer);
     return NULL;
@@ -34,6 +124,168 @@ void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
   return result;
 }
 
+static size_t blockSize(int sizeClass) {
+  return (size_t)(sizeClass + 1) * POOL_GRANULE;
+}
+
+static int sizeClassOf(size_t size) {
+  return (int)((size - 1) / POOL_GRANULE);
+}
+
+static PoolPage *pageOf(void *block) {
+  return (PoolPage *)((uintptr_t)block & ~(uintptr_t)(POOL_PAGE_SIZE - 1));
+}
+
+static void unlinkPage(PoolPage **list, PoolPage *page) {
+  if (page->prev != NULL) {
+    page->prev->next = page->next;
+  } else {
+    *list = page->next;
+  }
+  if (page->next != NULL) {
+    page->next->prev = page->prev;
+  }
+}
+
+static void linkPage(PoolPage **list, PoolPage *page) {
+  page->prev = NULL;
+  page->next = *list;
+  if (*list != NULL) {
+    (*list)->prev = page;
+  }
+  *list = page;
+}
+
+// an empty page set up for sizeClass, reused from the empty list if any
+// class left one there
+static PoolPage *newPage(int sizeClass) {
+  PoolPage *page = pool.empty;
+  if (page != NULL) {
+    unlinkPage(&pool.empty, page);
+    pool.emptyCount--;
+  } else {
+    page = aligned_alloc(POOL_PAGE_SIZE, POOL_PAGE_SIZE);
+    if (page == NULL)
+      exit(1);
+    POISON_BLOCK((uint8_t *)page + POOL_PAGE_HEADER,
+                 POOL_PAGE_SIZE - POOL_PAGE_HEADER);
+  }
+
+  page->freeBlocks = NULL;
+  page->bump = (uint8_t *)page + POOL_PAGE_HEADER;
+  page->live = 0;
+  page->sizeClass = sizeClass;
+  linkPage(&pool.available[sizeClass], page);
+  return page;
+}
+
+static bool pageHasRoom(PoolPage *page) {
+  return page->freeBlocks != NULL ||
+         (size_t)((uint8_t *)page + POOL_PAGE_SIZE - page->bump) >=
+             blockSize(page->sizeClass);
+}
+
+static void *takeBlock(int sizeClass) {
+  PoolPage *page = pool.available[sizeClass];
+  if (page == NULL) {
+    page = newPage(sizeClass);
+  }
+
+  size_t size = blockSize(sizeClass);
+  PoolBlock *block = page->freeBlocks;
+  if (block != NULL) {
+    UNPOISON_BLOCK(block, size);
+    page->freeBlocks = block->next;
+  } else {
+    block = (PoolBlock *)page->bump;
+    page->bump += size;
+    UNPOISON_BLOCK(block, size);
+  }
+
+  page->live++;
+  if (!pageHasRoom(page)) {
+    unlinkPage(&pool.available[sizeClass], page);
+    linkPage(&pool.full[sizeClass], page);
+  }
+  return block;
+}
+
+// a page whose last block comes back is emptied for any class to take
+static void returnBlock(PoolBlock *block) {
+  PoolPage *page = pageOf(block);
+  int sizeClass = page->sizeClass;
+  if (!pageHasRoom(page)) {
+    unlinkPage(&pool.full[sizeClass], page);
+    linkPage(&pool.available[sizeClass], page);
+  }
+
+  block->next = page->freeBlocks;
+  page->freeBlocks = block;
+  POISON_BLOCK(block, blockSize(sizeClass));
+  if (--page->live > 0)
+    return;
+
+  unlinkPage(&pool.available[sizeClass], page);
+  if (pool.emptyCount == POOL_EMPTY_PAGES_MAX) {
+    free(page);
+    return;
+  }
+  linkPage(&pool.empty, page);
+  pool.emptyCount++;
+}
+
+// memory for a new object. It is counted like any other allocation, and
+// may collect, before a block is taken from the pool. Pooled objects count
+// as the whole block they use
+void *allocateBlock(size_t size) {
+  if (size > POOL_MAX_SIZE) {
+    countAllocation(0, size);
+    void *result = malloc(size);
+    if (result == NULL)
+      exit(1);
+    return result;
+  }
+
+  int sizeClass = sizeClassOf(size);
+  countAllocation(0, blockSize(sizeClass));
+  return takeBlock(sizeClass);
+}
+
+void freeBlock(void *pointer, size_t size) {
+  if (size > POOL_MAX_SIZE) {
+    reallocate(pointer, size, 0);
+    return;
+  }
+
+  PoolBlock *block = (PoolBlock *)pointer;
+  if (onSweeper) {
+    sweeper.freedBytes += blockSize(sizeClassOf(size));
+    block->next = sweeper.freed;
+    sweeper.freed = block;
+    POISON_BLOCK(block, size);
+  } else {
+    vm.bytesAllocated -= blockSize(sizeClassOf(size));
+    returnBlock(block);
+  }
+}
+
+static void freePages(PoolPage *page) {
+  while (page != NULL) {
+    PoolPage *next = page->next;
+    free(page);
+    page = next;
+  }
+}
+
+static void freePool() {
+  for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+    freePages(pool.available[i]);
+    freePages(pool.full[i]);
+  }
+  freePages(pool.empty);
+  pool = (Pool){0};
+}
+
 void freeObject(Obj *object) {
 #ifdef DEBUG_LOG_GC
   printf("%p free type %d\n", (void *)object, object->type);
@@ -44,59 +296,154 @@ void freeObject(Obj *object) {
   switch (object->type) {
   case OBJ_STRING: {
     ObjString *string = (ObjString *)object;
-    FREE_ARRAY(char, string->chars, string->length + 1);
-    FREE(ObjString, object);
+    freeBlock(object, STRING_SIZE(string->length));
     break;
   }
 
   case OBJ_CLASS: {
     ObjClass *klass = (ObjClass *)object;
     freeTable(&klass->methods);
-    FREE(ObjClass, object);
+    FREE_ARRAY(ObjClosure *, klass->vtable, klass->vtableSize);
+    FREE_OBJECT(ObjClass, object);
     break;
   }
 
   case OBJ_FUNCTION: {
     ObjFunction *func = (ObjFunction *)object;
     freeChunk(&func->chunk);
-    FREE(ObjFunction, object);
+    jitFree(func->jit);
+    FREE_OBJECT(ObjFunction, object);
     break;
   }
 
   case OBJ_NATIVE:
-    FREE(ObjNative, object);
+    FREE_OBJECT(ObjNative, object);
     break;
 
   case OBJ_CLOSURE: {
     ObjClosure *closure = (ObjClosure *)object;
     FREE_ARRAY(ObjUpvalue *, closure->upvalues, closure->upvalueCount);
-    FREE(ObjClosure, object);
+    FREE_OBJECT(ObjClosure, object);
     break;
   }
 
   case OBJ_UPVALUE:
-    FREE(ObjUpvalue, object);
+    FREE_OBJECT(ObjUpvalue, object);
     break;
   case OBJ_INSTANCE: {
     ObjInstance *instance = (ObjInstance *)object;
-    freeTable(&instance->fields);
-    FREE(ObjInstance, object);
+    freeFields(instance);
+    freeTable(&instance->dictionary);
+    freeBlock(object, INSTANCE_SIZE(instance->inlineCapacity));
     break;
   }
   case OBJ_BOUND_METHOD:
-    FREE(ObjBoundMethod, object);
+    FREE_OBJECT(ObjBoundMethod, object);
+    break;
+  case OBJ_SHAPE: {
+    ObjShape *shape = (ObjShape *)object;
+    freeTable(&shape->transitions);
+    FREE_OBJECT(ObjShape, object);
+    break;
+  }
+  case OBJ_ROPE:
+    FREE_OBJECT(ObjRope, object);
     break;
   }
 }
 
-void freeObjects() {
-  Obj *object = vm.objects;
+static void freeList(Obj *object) {
   while (object != NULL) {
     Obj *next = object->next;
     freeObject(object);
     object = next;
   }
+}
+
+static void *sweepInBackground(void *arg) {
+  (void)arg;
+  onSweeper = true;
+  freeList(sweeper.garbage);
+
+  Obj *object = sweeper.objects;
+  while (object != NULL) {
+    Obj *next = object->next;
+    if (object->isMarked) {
+      object->next = NULL;
+      if (sweeper.survivorsTail != NULL) {
+        sweeper.survivorsTail->next = object;
+      } else {
+        sweeper.survivors = object;
+      }
+      sweeper.survivorsTail = object;
+    } else {
+      freeObject(object);
+    }
+    object = next;
+  }
+  return NULL;
+}
+
+// hands the dead young objects and, for a major collection, the detached old
+// generation to the sweeper. Sweeps right here if no thread can be started
+static void startSweeper(Obj *garbage, Obj *objects, bool major) {
+  if (garbage == NULL && objects == NULL)
+    return;
+
+  sweeper.garbage = garbage;
+  sweeper.objects = objects;
+  sweeper.survivors = NULL;
+  sweeper.survivorsTail = NULL;
+  sweeper.freedBytes = 0;
+  sweeper.freed = NULL;
+  sweeper.major = major;
+  sweeper.running = true;
+  sweeper.threaded =
+      pthread_create(&sweeper.thread, NULL, sweepInBackground, NULL) == 0;
+  if (!sweeper.threaded) {
+    sweepInBackground(NULL);
+    onSweeper = false;
+  }
+}
+
+// waits for the sweeper, gives the old survivors back to the VM and settles
+// the byte count. Thresholds of a major collection were only estimated when
+// it was started, so they are set again now that the garbage is gone
+static void joinSweeper() {
+  if (!sweeper.running)
+    return;
+
+  if (sweeper.threaded) {
+    pthread_join(sweeper.thread, NULL);
+  }
+  sweeper.running = false;
+
+  if (sweeper.survivorsTail != NULL) {
+    sweeper.survivorsTail->next = vm.oldObjects;
+    vm.oldObjects = sweeper.survivors;
+  }
+  // pages are only touched on this thread, so the sweeper's blocks go
+  // back to theirs now
+  PoolBlock *block = sweeper.freed;
+  while (block != NULL) {
+    UNPOISON_BLOCK(block, sizeof(PoolBlock));
+    PoolBlock *next = block->next;
+    returnBlock(block);
+    block = next;
+  }
+  vm.bytesAllocated -= sweeper.freedBytes;
+  if (sweeper.major) {
+    vm.nextMajorGC = vm.bytesAllocated * GC_HEAP_GROWTH_FACTOR;
+  }
+}
+
+void freeObjects() {
+  joinSweeper();
+  freeList(vm.objects);
+  freeList(vm.oldObjects);
   free(vm.grayStack);
+  free(vm.remembered);
+  freePool();
 }
 
 void markObject(Obj *object) {
@@ -119,6 +466,8 @@ void markObject(Obj *object) {
     if (vm.grayStack == NULL)
       exit(1);
   }
+
+  vm.grayStack[vm.grayCount++] = object;
 }
 
 void markValue(Value value) {
@@ -140,8 +489,13 @@ static void markRoots() {
     markObject((Obj *)upvalue);
   }
 
-  markTable(&vm.globals);
+  markTable(&vm.globalNames);
+  for (int i = 0; i < vm.globalCount; i++) {
+    markObject((Obj *)vm.globals[i].name);
+    markValue(vm.globals[i].value);
+  }
   markCompilerRoots();
+  markSnapshotRoots();
   markObject((Obj *)vm.initString);
 }
 
@@ -151,6 +505,17 @@ void markArray(ValueArray *value) {
   }
 }
 
+static void markInlineCaches(Chunk *chunk) {
+  for (int i = 0; i < chunk->cacheCount; i++) {
+    InlineCache *cache = &chunk->caches[i];
+    for (int j = 0; j < cache->count; j++) {
+      markObject((Obj *)cache->entries[j].shape);
+      markObject((Obj *)cache->entries[j].transition);
+      markObject((Obj *)cache->entries[j].method);
+    }
+  }
+}
+
 static void blackenObject(Obj *object) {
 #ifdef DEBUG_LOG_GC
   printf("%p blacken ", (void *)object);
@@ -162,6 +527,7 @@ static void blackenObject(Obj *object) {
     ObjFunction *function = (ObjFunction *)object;
     markObject((Obj *)function->name);
     markArray(&function->chunk.constants);
+    markInlineCaches(&function->chunk);
     break;
   }
   case OBJ_CLOSURE: {
@@ -180,13 +546,20 @@ static void blackenObject(Obj *object) {
     ObjClass *klass = (ObjClass *)object;
     markObject((Obj *)(klass->name));
     markTable(&klass->methods);
+    markObject((Obj *)klass->rootShape);
     break;
   }
 
   case OBJ_INSTANCE: {
     ObjInstance *instance = (ObjInstance *)object;
     markObject((Obj *)(instance->className));
-    markTable(&instance->fields);
+    if (instance->shape != NULL) {
+      markObject((Obj *)instance->shape);
+      for (int i = 0; i < instance->shape->fieldCount; i++) {
+        markValue(instance->fields[i]);
+      }
+    }
+    markTable(&instance->dictionary);
     break;
   }
   case OBJ_BOUND_METHOD: {
@@ -196,52 +569,177 @@ static void blackenObject(Obj *object) {
     break;
   }
 
+  case OBJ_SHAPE: {
+    ObjShape *shape = (ObjShape *)object;
+    markObject((Obj *)shape->parent);
+    markObject((Obj *)shape->name);
+    markTable(&shape->transitions);
+    break;
+  }
+
+  case OBJ_ROPE: {
+    ObjRope *rope = (ObjRope *)object;
+    markObject(rope->left);
+    markObject(rope->right);
+    markObject((Obj *)rope->flat);
+    break;
+  }
+
   case OBJ_STRING:
   case OBJ_NATIVE:
     break;
   }
 }
 
+void rememberObject(Obj *object) {
+  if (!object->isOld || object->isRemembered)
+    return;
+
+  if (vm.rememberedCapacity < vm.rememberedCount + 1) {
+    vm.rememberedCapacity = GROW_CAPACITY(vm.rememberedCapacity);
+    vm.remembered =
+        (Obj **)realloc(vm.remembered, sizeof(Obj *) * vm.rememberedCapacity);
+    if (vm.remembered == NULL)
+      exit(1);
+  }
+
+  object->isRemembered = true;
+  vm.remembered[vm.rememberedCount++] = object;
+}
+
 static void traceReferences() {
   while (vm.grayCount > 0) {
     blackenObject(vm.grayStack[--vm.grayCount]);
   }
 }
 
-static void sweep() {
+// the remembered objects are the only old ones with young children, their
+// children are marked as if the objects were roots
+static void traceRemembered() {
+  for (int i = 0; i < vm.rememberedCount; i++) {
+    vm.remembered[i]->isRemembered = false;
+    blackenObject(vm.remembered[i]);
+  }
+  vm.rememberedCount = 0;
+}
+
+static void forgetRemembered() {
+  for (int i = 0; i < vm.rememberedCount; i++) {
+    vm.remembered[i]->isRemembered = false;
+  }
+  vm.rememberedCount = 0;
+}
+
+// promotes the marked young objects, they keep their mark as old objects,
+// and returns the unmarked ones for the sweeper to free. The young
+// generation is empty afterwards
+static Obj *sweepYoung() {
+  Obj *garbage = NULL;
   Obj *object = vm.objects;
-  Obj *previous = NULL;
   while (object != NULL) {
+    Obj *next = object->next;
     if (object->isMarked) {
-      object->isMarked = false;
-      previous = object;
-      object = object->next;
+      object->isOld = true;
+      object->next = vm.oldObjects;
+      vm.oldObjects = object;
     } else {
-      Obj *unreached = object;
-      object = object->next;
-      if (previous != NULL) {
-        previous->next = object;
-      } else {
-        vm.objects = object;
-      }
-      freeObject(unreached);
+      object->next = garbage;
+      garbage = object;
     }
+    object = next;
+  }
+  vm.objects = NULL;
+  return garbage;
+}
+
+static void clearOldMarks() {
+  for (Obj *object = vm.oldObjects; object != NULL; object = object->next) {
+    object->isMarked = false;
   }
 }
 
+// the old generation is detached for the sweeper before the young
+// survivors are promoted into a fresh list, so those are never walked twice
+static void sweepMajor() {
+  tableRemoveWhite(&vm.strings);
+  Obj *objects = vm.oldObjects;
+  vm.oldObjects = NULL;
+  Obj *garbage = sweepYoung();
+  // every survivor is old now, and old objects only point at old ones
+  forgetRemembered();
+
+  vm.gcMarking = false;
+  vm.nextMajorGC = vm.bytesAllocated * GC_HEAP_GROWTH_FACTOR;
+  vm.nextGC = vm.bytesAllocated + GC_NURSERY_SIZE;
+  startSweeper(garbage, objects, true);
+}
+
+// blackens at most a slice budget's worth of gray objects. Once none are
+// left the roots are scanned again, they are written without barriers, and
+// whatever they still reach is traced before sweeping
+static void markSlice() {
+  for (int work = 0; work < vm.gcSliceBudget && vm.grayCount > 0; work++) {
+    blackenObject(vm.grayStack[--vm.grayCount]);
+  }
+
+  if (vm.grayCount > 0) {
+    vm.nextGC = vm.bytesAllocated + GC_SLICE_SIZE;
+    return;
+  }
+
+  markRoots();
+  traceReferences();
+  sweepMajor();
+}
+
+// a minor collection only traces and sweeps the young generation. A major
+// one clears the old generation's marks first and then collects everything,
+// spread over slices unless the budget is 0. Neither moves objects, the VM
+// holds raw pointers to them everywhere
 void collectGarbage() {
+  size_t before = vm.bytesAllocated;
+
+  if (vm.gcMarking) {
 #ifdef DEBUG_LOG_GC
-  printf("-- gc begin\n");
+    printf("-- gc slice\n");
 #endif /* ifdef DEBUG_LOG_GC */
+    markSlice();
+    return;
+  }
 
-  size_t before = vm.bytesAllocated;
+  // a collection never starts while the previous sweep still owns objects
+  joinSweeper();
+  bool major = vm.bytesAllocated > vm.nextMajorGC;
+#ifdef DEBUG_STRESS_GC
+  // otherwise the heap stays too small for the old generation to be swept
+  static int collections = 0;
+  major = major || ++collections % 16 == 0;
+#endif
 
-  markRoots();
-  traceReferences();
-  tableRemoveWhite(&vm.strings);
-  sweep();
+#ifdef DEBUG_LOG_GC
+  printf("-- gc begin %s\n", major ? "major" : "minor");
+#endif /* ifdef DEBUG_LOG_GC */
 
-  vm.nextGC = vm.bytesAllocated * GC_HEAP_GROWTH_FACTOR;
+  if (major) {
+    forgetRemembered();
+    clearOldMarks();
+    markRoots();
+    if (vm.gcSliceBudget > 0) {
+      vm.gcMarking = true;
+      markSlice();
+      return;
+    }
+    traceReferences();
+    sweepMajor();
+  } else {
+    markRoots();
+    traceRemembered();
+    traceReferences();
+    tableRemoveWhite(&vm.strings);
+    Obj *garbage = sweepYoung();
+    vm.nextGC = vm.bytesAllocated + GC_NURSERY_SIZE;
+    startSweeper(garbage, NULL, false);
+  }
 
 #ifdef DEBUG_LOG_GC
   printf("-- gc end\n");
@@ -3,15 +3,18 @@
 #include "../include/vm.h"
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define ALLOCATE_OBJ(type, objectType)                                         \
   (type *)allocateObject(sizeof(type), objectType)
 
 static Obj *allocateObject(size_t size, ObjType type) {
-  Obj *object = (Obj *)reallocate(NULL, 0, size);
+  Obj *object = (Obj *)allocateBlock(size);
   object->type = type;
   object->isMarked = false;
+  object->isOld = false;
+  object->isRemembered = false;
 
   object->next = vm.objects;
   vm.objects = object;
@@ -33,54 +36,128 @@ static uint32_t hashString(const char *key, int length) {
   return hash;
 }
 
-static ObjString *allocateString(char *chars, int length, uint32_t hash) {
-  ObjString *string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+static ObjString *allocateString(int length) {
+  ObjString *string =
+      (ObjString *)allocateObject(STRING_SIZE(length), OBJ_STRING);
   string->length = length;
-  string->chars = chars;
+  string->hash = 0;
+  string->hasHash = false;
+  string->isInterned = false;
+  string->selector = -1;
+  string->chars[length] = '\0';
+  return string;
+}
+
+// a string that is not interned, the caller fills in its characters
+ObjString *newString(int length) { return allocateString(length); }
+
+uint32_t stringHash(ObjString *string) {
+  if (!string->hasHash) {
+    string->hash = hashString(string->chars, string->length);
+    string->hasHash = true;
+  }
+  return string->hash;
+}
+
+// two interned strings are only equal if they are the same object
+bool stringsEqual(ObjString *a, ObjString *b) {
+  if (a == b)
+    return true;
+  if ((a->isInterned && b->isInterned) || a->length != b->length)
+    return false;
+  if (a->hasHash && b->hasHash && a->hash != b->hash)
+    return false;
+  return memcmp(a->chars, b->chars, a->length) == 0;
+}
+
+ObjString *copyString(const char *chars, int length) {
+  uint32_t hash = hashString(chars, length);
+
+  ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
+  if (interned != NULL)
+    return interned;
+
+  ObjString *string = allocateString(length);
+  memcpy(string->chars, chars, length);
   string->hash = hash;
+  string->hasHash = true;
+  string->isInterned = true;
   push(OBJ_VAL(string));
   tableSet(&vm.strings, string, NIL_VAL);
   pop();
   return string;
 }
 
-ObjString *tableFindString(Table *table, const char *chars, int length,
-                           uint32_t hash) {
-  // no table then return
-  if (table->count == 0)
-    return NULL;
+// a flattened half is replaced by its string so chains don't keep growing
+static Obj *ropeHalf(Obj *text) {
+  if (text->type == OBJ_ROPE && ((ObjRope *)text)->flat != NULL)
+    return (Obj *)((ObjRope *)text)->flat;
+  return text;
+}
+
+ObjRope *newRope(Obj *left, Obj *right, int length) {
+  ObjRope *rope = ALLOCATE_OBJ(ObjRope, OBJ_ROPE);
+  rope->length = length;
+  rope->left = ropeHalf(left);
+  rope->right = ropeHalf(right);
+  rope->flat = NULL;
+  return rope;
+}
 
-  // map hash to hashtable array
-  uint32_t index = hash % table->capacity;
+// visits the flat pieces left to right. A rope built in a loop is as deep
+// as the loop ran, so the walk keeps its own stack instead of recursing
+void visitRope(ObjRope *rope, RopeVisitor visit, void *context) {
+  int capacity = 8;
+  int count = 0;
+  Obj **stack = malloc(sizeof(Obj *) * capacity);
+  if (stack == NULL)
+    exit(1);
+  stack[count++] = (Obj *)rope;
 
-  // find match
-  for (;;) {
-    Entry *entry = &table->entries[index];
-    if (entry->key == NULL) {
-      if (IS_NIL(entry->value)) {
-        return NULL;
-      }
+  while (count > 0) {
+    Obj *text = stack[--count];
+    if (text->type == OBJ_STRING) {
+      visit((ObjString *)text, context);
+      continue;
+    }
 
-    } else if (entry->key->length == length && entry->key->hash == hash &&
-               entry->key->length == length &&
-               memcmp(entry->key->chars, chars, length) == 0) {
-      return entry->key;
+    ObjRope *node = (ObjRope *)text;
+    if (node->flat != NULL) {
+      visit(node->flat, context);
+      continue;
     }
-    index = (index + 1) % table->capacity;
+    if (capacity < count + 2) {
+      capacity = GROW_CAPACITY(capacity);
+      stack = realloc(stack, sizeof(Obj *) * capacity);
+      if (stack == NULL)
+        exit(1);
+    }
+    stack[count++] = node->right;
+    stack[count++] = node->left;
   }
+  free(stack);
 }
 
-ObjString *copyString(const char *chars, int length) {
-  uint32_t hash = hashString(chars, length);
+static void appendPiece(ObjString *piece, void *context) {
+  char **end = (char **)context;
+  memcpy(*end, piece->chars, piece->length);
+  *end += piece->length;
+}
 
-  ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
-  if (interned != NULL)
-    return interned;
+// the rope must be reachable, allocating the flat string can collect
+ObjString *flattenRope(ObjRope *rope) {
+  if (rope->flat != NULL)
+    return rope->flat;
 
-  char *heapChars = ALLOCATE(char, length + 1);
-  memcpy(heapChars, chars, length);
-  heapChars[length] = '\0';
-  return allocateString(heapChars, length, hash);
+  ObjString *flat = newString(rope->length);
+  char *end = flat->chars;
+  visitRope(rope, appendPiece, &end);
+
+  rope->flat = flat;
+  rope->left = NULL;
+  rope->right = NULL;
+  writeBarrier((Obj *)rope, (Obj *)flat);
+  return flat;
 }
 
 ObjUpvalue *newUpvalue(Value *slot) {
@@ -99,6 +176,11 @@ void printFunction(ObjFunction *function) {
   printf("<fn %s>", function->name->chars);
 }
 
+static void printPiece(ObjString *piece, void *context) {
+  (void)context;
+  fwrite(piece->chars, 1, piece->length, stdout);
+}
+
 void printObject(Value value) {
   switch (OBJ_TYPE(value)) {
   case OBJ_STRING:
@@ -125,26 +207,24 @@ void printObject(Value value) {
   case OBJ_BOUND_METHOD:
     printFunction(AS_BOUND_METHOD(value)->method->function);
     break;
+  case OBJ_SHAPE:
+    printf("shape");
+    break;
+  case OBJ_ROPE:
+    visitRope(AS_ROPE(value), printPiece, NULL);
+    break;
   }
 }
 
-ObjString *takeString(char *chars, int length) {
-  uint32_t hash = hashString(chars, length);
-
-  ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
-  if (interned != NULL) {
-    FREE_ARRAY(char, chars, length + 1);
-    return interned;
-  }
-
-  return allocateString(chars, length, hash);
-}
 
 ObjFunction *newFunction() {
   ObjFunction *function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
   function->arity = 0;
   function->upvalueCount = 0;
   function->name = NULL;
+  function->hotness = 0;
+  function->jitFailed = false;
+  function->jit = NULL;
   initChunk(&function->chunk);
   return function;
 }
@@ -173,17 +253,207 @@ ObjClosure *newClosure(ObjFunction *function) {
 ObjClass *newClass(ObjString *name) {
   ObjClass *klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
   klass->name = name;
+  klass->rootShape = NULL;
   initTable(&klass->methods);
+  klass->vtable = NULL;
+  klass->vtableSize = 0;
+  klass->initializer = NULL;
+  klass->fieldHint = 0;
+
+  push(OBJ_VAL(klass));
+  klass->rootShape = newShape(NULL, NULL);
+  writeBarrier((Obj *)klass, (Obj *)klass->rootShape);
+  pop();
   return klass;
 }
 
+// selectors are handed out once per name, by the compiler for the method
+// names it sees and otherwise when a method is first defined
+int methodSelector(ObjString *name) {
+  if (name->selector < 0) {
+    name->selector = vm.selectorCount++;
+  }
+  return name->selector;
+}
+
+// grows the vtable just far enough to hold selector. A class's vtable only
+// spans the selectors it or its superclasses define, higher ones fall off
+// the end in findMethod
+static void growVtable(ObjClass *klass, int selector) {
+  if (selector < klass->vtableSize)
+    return;
+
+  int size = selector + 1;
+  klass->vtable =
+      GROW_ARRAY(ObjClosure *, klass->vtable, klass->vtableSize, size);
+  for (int i = klass->vtableSize; i < size; i++) {
+    klass->vtable[i] = NULL;
+  }
+  klass->vtableSize = size;
+}
+
+void vtableSet(ObjClass *klass, ObjString *name, ObjClosure *method) {
+  int selector = methodSelector(name);
+  growVtable(klass, selector);
+  klass->vtable[selector] = method;
+  if (name == vm.initString) {
+    klass->initializer = method;
+  }
+}
+
+void vtableInherit(ObjClass *superClass, ObjClass *subClass) {
+  growVtable(subClass, superClass->vtableSize - 1);
+  for (int i = 0; i < superClass->vtableSize; i++) {
+    if (superClass->vtable[i] != NULL) {
+      subClass->vtable[i] = superClass->vtable[i];
+    }
+  }
+  if (superClass->initializer != NULL) {
+    subClass->initializer = superClass->initializer;
+  }
+}
+
+ObjShape *newShape(ObjShape *parent, ObjString *name) {
+  ObjShape *shape = ALLOCATE_OBJ(ObjShape, OBJ_SHAPE);
+  shape->parent = parent;
+  shape->name = name;
+  shape->fieldCount = parent == NULL ? 0 : parent->fieldCount + 1;
+  initTable(&shape->transitions);
+  return shape;
+}
+
+// the shape an instance moves to when 'name' is added, NULL when the
+// instance should give up on shapes instead
+ObjShape *shapeTransition(ObjShape *shape, ObjString *name) {
+  Value next;
+  if (tableGet(&shape->transitions, name, &next)) {
+    return AS_SHAPE(next);
+  }
+
+  if (shape->fieldCount == SHAPE_MAX_FIELDS ||
+      shape->transitions.count == SHAPE_MAX_TRANSITIONS) {
+    return NULL;
+  }
+
+  ObjShape *child = newShape(shape, name);
+  push(OBJ_VAL(child));
+  tableSet(&shape->transitions, name, OBJ_VAL(child));
+  writeBarrier((Obj *)shape, (Obj *)name);
+  writeBarrier((Obj *)shape, (Obj *)child);
+  pop();
+  return child;
+}
+
+int shapeFieldIndex(ObjShape *shape, ObjString *name) {
+  for (; shape->parent != NULL; shape = shape->parent) {
+    if (shape->name == name)
+      return shape->fieldCount - 1;
+  }
+  return -1;
+}
+
+// the fields live in the same block as the instance, as many as the
+// class's last instance needed
 ObjInstance *newInstance(ObjClass *className) {
-  ObjInstance *instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
+  int capacity = className->fieldHint;
+  ObjInstance *instance = (ObjInstance *)allocateObject(
+      INSTANCE_SIZE(capacity), OBJ_INSTANCE);
   instance->className = className;
-  initTable(&instance->fields);
+  instance->shape = className->rootShape;
+  instance->fields = capacity > 0 ? instance->inlineFields : NULL;
+  instance->fieldCapacity = capacity;
+  instance->inlineCapacity = capacity;
+  initTable(&instance->dictionary);
   return instance;
 }
 
+void setFieldHint(ObjClass *klass, int fieldCount) {
+  klass->fieldHint = fieldCount < FIELD_HINT_MAX ? fieldCount : FIELD_HINT_MAX;
+}
+
+void freeFields(ObjInstance *instance) {
+  if (instance->fields != instance->inlineFields) {
+    FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
+  }
+  instance->fields = NULL;
+  instance->fieldCapacity = 0;
+}
+
+// moves the fields to the heap once they outgrow the inline ones. Those
+// can't be given back, FIELD_HINT_MAX bounds them
+void reserveFields(ObjInstance *instance, int capacity) {
+  if (capacity <= instance->fieldCapacity)
+    return;
+
+  if (instance->fields == instance->inlineFields) {
+    Value *fields = ALLOCATE(Value, capacity);
+    memcpy(fields, instance->fields, sizeof(Value) * instance->fieldCapacity);
+    instance->fields = fields;
+  } else {
+    instance->fields = GROW_ARRAY(Value, instance->fields,
+                                  instance->fieldCapacity, capacity);
+  }
+  instance->fieldCapacity = capacity;
+}
+
+bool instanceGetField(ObjInstance *instance, ObjString *name, Value *value) {
+  if (instance->shape == NULL) {
+    return tableGet(&instance->dictionary, name, value);
+  }
+
+  int index = shapeFieldIndex(instance->shape, name);
+  if (index == -1)
+    return false;
+
+  *value = instance->fields[index];
+  return true;
+}
+
+// moves the fields out of the flat array into the instance's own table
+static void toDictionaryMode(ObjInstance *instance) {
+  for (ObjShape *shape = instance->shape; shape->parent != NULL;
+       shape = shape->parent) {
+    tableSet(&instance->dictionary, shape->name,
+             instance->fields[shape->fieldCount - 1]);
+    writeBarrier((Obj *)instance, (Obj *)shape->name);
+  }
+
+  freeFields(instance);
+  instance->shape = NULL;
+}
+
+// returns true if the field is new, callers keep instance and value rooted
+bool instanceSetField(ObjInstance *instance, ObjString *name, Value value) {
+  if (instance->shape != NULL) {
+    int index = shapeFieldIndex(instance->shape, name);
+    if (index != -1) {
+      instance->fields[index] = value;
+      writeBarrierValue((Obj *)instance, value);
+      return false;
+    }
+
+    ObjShape *next = shapeTransition(instance->shape, name);
+    if (next != NULL) {
+      if (instance->fieldCapacity < next->fieldCount) {
+        reserveFields(instance, GROW_CAPACITY(instance->fieldCapacity));
+      }
+      instance->fields[next->fieldCount - 1] = value;
+      instance->shape = next;
+      noteFieldAdded(instance);
+      writeBarrierValue((Obj *)instance, value);
+      writeBarrier((Obj *)instance, (Obj *)next);
+      return true;
+    }
+
+    toDictionaryMode(instance);
+  }
+
+  bool isNewField = tableSet(&instance->dictionary, name, value);
+  writeBarrier((Obj *)instance, (Obj *)name);
+  writeBarrierValue((Obj *)instance, value);
+  return isNewField;
+}
+
 ObjBoundMethod *newBoundMethod(Value receiver, ObjClosure *method) {
   ObjBoundMethod *bound = ALLOCATE_OBJ(ObjBoundMethod, OBJ_BOUND_METHOD);
   bound->method = method;
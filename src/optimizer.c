@@ -0,0 +1,212 @@
+#include <stdint.h>
+
+#include "../include/chunk.h"
+#include "../include/memory.h"
+#include "../include/object.h"
+#include "../include/optimizer.h"
+
+// a superinstruction and the run of instructions it replaces, its operands
+// are the operands of the replaced instructions in order. Picked from the
+// opcode pair histogram `make pairs` prints for the bench scripts
+typedef struct {
+  OpCode fused;
+  int count;
+  OpCode ops[5];
+} Superinstruction;
+
+static const Superinstruction superinstructions[] = {
+    {OP_LESS_LOCAL_CONST_JUMP,
+     5,
+     {OP_GET_LOCAL, OP_CONSTANT, OP_LESS, OP_JUMP_IF_FALSE, OP_POP}},
+    {OP_GREATER_LOCAL_CONST_JUMP,
+     5,
+     {OP_GET_LOCAL, OP_CONSTANT, OP_GREATER, OP_JUMP_IF_FALSE, OP_POP}},
+    {OP_ADD_LOCAL_LOCAL, 3, {OP_GET_LOCAL, OP_GET_LOCAL, OP_ADD}},
+    {OP_ADD_LOCAL_CONST, 3, {OP_GET_LOCAL, OP_CONSTANT, OP_ADD}},
+    {OP_SUBTRACT_LOCAL_CONST, 3, {OP_GET_LOCAL, OP_CONSTANT, OP_SUBTRACT}},
+    {OP_GET_LOCAL_INST, 2, {OP_GET_LOCAL, OP_GET_INST}},
+    {OP_JUMP_IF_FALSE_POP, 2, {OP_JUMP_IF_FALSE, OP_POP}},
+    {OP_SET_LOCAL_POP, 2, {OP_SET_LOCAL, OP_POP}},
+};
+
+#define SUPERINSTRUCTION_COUNT                                                 \
+  (int)(sizeof(superinstructions) / sizeof(superinstructions[0]))
+
+int instructionLength(Chunk *chunk, int offset) {
+  switch (chunk->code[offset]) {
+  case OP_CONSTANT:
+  case OP_GET_LOCAL:
+  case OP_SET_LOCAL:
+  case OP_GET_UPVALUE:
+  case OP_SET_UPVALUE:
+  case OP_CALL:
+  case OP_CLASS:
+  case OP_METHOD:
+  case OP_GET_SUPER:
+  case OP_SET_LOCAL_POP:
+    return 2;
+
+  case OP_DEFINE_GLOBAL:
+  case OP_GET_GLOBAL:
+  case OP_SET_GLOBAL:
+  case OP_JUMP:
+  case OP_JUMP_IF_FALSE:
+  case OP_LOOP:
+  case OP_INVOKE_SUPER:
+  case OP_ADD_LOCAL_LOCAL:
+  case OP_ADD_LOCAL_CONST:
+  case OP_SUBTRACT_LOCAL_CONST:
+  case OP_JUMP_IF_FALSE_POP:
+    return 3;
+
+  case OP_GET_INST:
+  case OP_SET_INST:
+  case OP_MOVE_REG:
+    return 4;
+
+  case OP_INVOKE:
+  case OP_GET_LOCAL_INST:
+  case OP_LESS_LOCAL_CONST_JUMP:
+  case OP_GREATER_LOCAL_CONST_JUMP:
+  case OP_ADD_REG:
+  case OP_SUBTRACT_REG:
+  case OP_MULTIPLY_REG:
+  case OP_DIVIDE_REG:
+    return 5;
+
+  case OP_CLOSURE: {
+    Value constant = chunk->constants.values[chunk->code[offset + 1]];
+    return 2 + AS_FUNCTION(constant)->upvalueCount * 2;
+  }
+
+  default:
+    return 1;
+  }
+}
+
+// every jump keeps its 16 bit offset in its last two bytes
+static bool isJump(uint8_t op) {
+  switch (op) {
+  case OP_JUMP:
+  case OP_JUMP_IF_FALSE:
+  case OP_LOOP:
+  case OP_JUMP_IF_FALSE_POP:
+  case OP_LESS_LOCAL_CONST_JUMP:
+  case OP_GREATER_LOCAL_CONST_JUMP:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static int jumpTarget(Chunk *chunk, int offset) {
+  int end = offset + instructionLength(chunk, offset);
+  int jump = (chunk->code[end - 2] << 8) | chunk->code[end - 1];
+  return chunk->code[offset] == OP_LOOP ? end - jump : end + jump;
+}
+
+// the superinstruction that can replace the instructions at offset. Only the
+// first of them may be a jump target, otherwise a jump would land inside it
+static const Superinstruction *findSuperinstruction(Chunk *chunk, int offset,
+                                                    bool *targets) {
+  for (int i = 0; i < SUPERINSTRUCTION_COUNT; i++) {
+    const Superinstruction *super = &superinstructions[i];
+    int position = offset;
+    int matched = 0;
+
+    while (matched < super->count && position < chunk->count) {
+      if (chunk->code[position] != super->ops[matched]) break;
+      if (matched > 0 && targets[position]) break;
+      position += instructionLength(chunk, position);
+      matched++;
+    }
+
+    if (matched == super->count) return super;
+  }
+  return NULL;
+}
+
+// fuses common instruction sequences into superinstructions. The code only
+// ever shrinks so it is rewritten in place, with jumps relocated through a
+// map from old to new offsets
+void optimizeChunk(Chunk *chunk) {
+  int count = chunk->count;
+  bool *targets = ALLOCATE(bool, count + 1);
+  int *newOffsets = ALLOCATE(int, count + 1);
+  const Superinstruction **fusions =
+      ALLOCATE(const Superinstruction *, count + 1);
+
+  for (int i = 0; i <= count; i++) {
+    targets[i] = false;
+  }
+  for (int offset = 0; offset < count;) {
+    if (isJump(chunk->code[offset])) {
+      targets[jumpTarget(chunk, offset)] = true;
+    }
+    offset += instructionLength(chunk, offset);
+  }
+
+  int out = 0;
+  for (int offset = 0; offset < count;) {
+    const Superinstruction *super =
+        findSuperinstruction(chunk, offset, targets);
+    newOffsets[offset] = out;
+    fusions[offset] = super;
+
+    int parts = super != NULL ? super->count : 1;
+    out += super != NULL ? 1 : 0;
+    for (int i = 0; i < parts; i++) {
+      int length = instructionLength(chunk, offset);
+      out += super != NULL ? length - 1 : length;
+      offset += length;
+    }
+  }
+  newOffsets[count] = out;
+
+  // every byte is read before it can be overwritten since the write
+  // position never passes the read position
+  int read = 0;
+  int write = 0;
+  while (read < count) {
+    const Superinstruction *super = fusions[read];
+    int start = write;
+    int line = chunk->lines[read];
+    int oldTarget = -1;
+    bool backwards = false;
+
+    // the fused opcode is stored last, it may sit on the first opcode read
+    if (super != NULL) {
+      chunk->lines[write++] = line;
+    }
+
+    int parts = super != NULL ? super->count : 1;
+    for (int i = 0; i < parts; i++) {
+      int length = instructionLength(chunk, read);
+      if (isJump(chunk->code[read])) {
+        oldTarget = jumpTarget(chunk, read);
+        backwards = chunk->code[read] == OP_LOOP;
+      }
+
+      for (int j = super != NULL ? 1 : 0; j < length; j++) {
+        chunk->code[write] = chunk->code[read + j];
+        chunk->lines[write++] = line;
+      }
+      read += length;
+    }
+    if (super != NULL) {
+      chunk->code[start] = super->fused;
+    }
+
+    if (oldTarget != -1) {
+      int target = newOffsets[oldTarget];
+      int jump = backwards ? write - target : target - write;
+      chunk->code[write - 2] = (jump >> 8) & 0xff;
+      chunk->code[write - 1] = jump & 0xff;
+    }
+  }
+  chunk->count = write;
+
+  FREE_ARRAY(bool, targets, count + 1);
+  FREE_ARRAY(int, newOffsets, count + 1);
+  FREE_ARRAY(const Superinstruction *, fusions, count + 1);
+}
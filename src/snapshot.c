@@ -0,0 +1,947 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/chunk.h"
+#include "../include/loxc.h"
+#include "../include/memory.h"
+#include "../include/object.h"
+#include "../include/snapshot.h"
+#include "../include/vm.h"
+
+// a snapshot is the heap reachable from the globals once a script has run.
+// Every object gets an id and pointers are written as ids, restoring
+// allocates all the objects first and then fills in their references, so
+// the heap comes back with the same shape at new addresses. Objects are
+// written grouped by type, functions before the closures over them and
+// classes before their instances, so those can be created with their
+// constructors. Natives are written by name and looked up in the VM's
+// registry. Integers are little endian
+#define SNAPSHOT_MAGIC "LOXS"
+// bump whenever an object layout or the instruction set changes
+#define SNAPSHOT_VERSION 1
+
+#define NO_OBJECT UINT32_MAX
+
+typedef enum {
+  VALUE_NIL,
+  VALUE_FALSE,
+  VALUE_TRUE,
+  VALUE_NUMBER,
+  VALUE_OBJECT,
+} ValueTag;
+
+typedef struct {
+  Obj *object;
+  uint32_t id;
+} ObjectId;
+
+typedef struct {
+  FILE *file;
+  bool failed;
+  // every object to write, in id order once they are grouped by type
+  Obj **objects;
+  uint32_t count;
+  uint32_t capacity;
+  // object -> id, open addressing on the address
+  ObjectId *ids;
+  uint32_t idCapacity;
+} Writer;
+
+typedef struct {
+  const uint8_t *bytes;
+  size_t length;
+  size_t position;
+  bool failed;
+  // id -> restored object, NULL until it is allocated
+  Obj **objects;
+  uint32_t count;
+  // global slot in the snapshot -> global slot in this VM
+  int *slots;
+  int slotCount;
+} Reader;
+
+// the snapshot being restored, its objects are roots until it is done
+static Reader *restoring = NULL;
+
+static ObjectId *findId(Writer *writer, Obj *object) {
+  uint32_t mask = writer->idCapacity - 1;
+  uint32_t index = (uint32_t)(((uintptr_t)object >> 3) * 2654435761u) & mask;
+  for (;;) {
+    ObjectId *entry = &writer->ids[index];
+    if (entry->object == NULL || entry->object == object)
+      return entry;
+    index = (index + 1) & mask;
+  }
+}
+
+static void growIds(Writer *writer) {
+  ObjectId *old = writer->ids;
+  uint32_t oldCapacity = writer->idCapacity;
+
+  writer->idCapacity = oldCapacity < 64 ? 64 : oldCapacity * 2;
+  writer->ids = calloc(writer->idCapacity, sizeof(ObjectId));
+  if (writer->ids == NULL) {
+    writer->failed = true;
+    writer->ids = old;
+    writer->idCapacity = oldCapacity;
+    return;
+  }
+
+  for (uint32_t i = 0; i < oldCapacity; i++) {
+    if (old[i].object != NULL)
+      *findId(writer, old[i].object) = old[i];
+  }
+  free(old);
+}
+
+static void addObject(Writer *writer, Obj *object) {
+  if (object == NULL || writer->failed)
+    return;
+
+  if ((writer->count + 1) * 2 > writer->idCapacity) {
+    growIds(writer);
+    if (writer->failed)
+      return;
+  }
+
+  ObjectId *entry = findId(writer, object);
+  if (entry->object != NULL)
+    return;
+
+  if (writer->capacity < writer->count + 1) {
+    uint32_t capacity = GROW_CAPACITY(writer->capacity);
+    Obj **objects = realloc(writer->objects, sizeof(Obj *) * capacity);
+    if (objects == NULL) {
+      writer->failed = true;
+      return;
+    }
+    writer->objects = objects;
+    writer->capacity = capacity;
+  }
+
+  entry->object = object;
+  entry->id = writer->count;
+  writer->objects[writer->count++] = object;
+}
+
+static void addValue(Writer *writer, Value value) {
+  if (IS_OBJ(value))
+    addObject(writer, AS_OBJ(value));
+}
+
+static void addTable(Writer *writer, Table *table) {
+  for (int i = 0; i < table->capacity; i++) {
+    Entry *entry = &table->entries[i];
+    if (entry->key == NULL)
+      continue;
+    addObject(writer, (Obj *)entry->key);
+    addValue(writer, entry->value);
+  }
+}
+
+// mirrors blackenObject, except inline caches are left out since they start
+// empty after a restore
+static void addReferences(Writer *writer, Obj *object) {
+  switch (object->type) {
+  case OBJ_FUNCTION: {
+    ObjFunction *function = (ObjFunction *)object;
+    addObject(writer, (Obj *)function->name);
+    for (int i = 0; i < function->chunk.constants.count; i++) {
+      addValue(writer, function->chunk.constants.values[i]);
+    }
+    break;
+  }
+  case OBJ_CLOSURE: {
+    ObjClosure *closure = (ObjClosure *)object;
+    addObject(writer, (Obj *)closure->function);
+    for (int i = 0; i < closure->upvalueCount; i++) {
+      addObject(writer, (Obj *)closure->upvalues[i]);
+    }
+    break;
+  }
+  case OBJ_UPVALUE: {
+    ObjUpvalue *upvalue = (ObjUpvalue *)object;
+    // an open upvalue points into the stack, which is not part of the heap
+    if (upvalue->location != &upvalue->closed)
+      writer->failed = true;
+    addValue(writer, upvalue->closed);
+    break;
+  }
+  case OBJ_CLASS: {
+    ObjClass *klass = (ObjClass *)object;
+    addObject(writer, (Obj *)klass->name);
+    addTable(writer, &klass->methods);
+    addObject(writer, (Obj *)klass->rootShape);
+    break;
+  }
+  case OBJ_INSTANCE: {
+    ObjInstance *instance = (ObjInstance *)object;
+    addObject(writer, (Obj *)instance->className);
+    if (instance->shape != NULL) {
+      addObject(writer, (Obj *)instance->shape);
+      for (int i = 0; i < instance->shape->fieldCount; i++) {
+        addValue(writer, instance->fields[i]);
+      }
+    }
+    addTable(writer, &instance->dictionary);
+    break;
+  }
+  case OBJ_BOUND_METHOD: {
+    ObjBoundMethod *bound = (ObjBoundMethod *)object;
+    addValue(writer, bound->receiver);
+    addObject(writer, (Obj *)bound->method);
+    break;
+  }
+  case OBJ_SHAPE: {
+    ObjShape *shape = (ObjShape *)object;
+    addObject(writer, (Obj *)shape->parent);
+    addObject(writer, (Obj *)shape->name);
+    addTable(writer, &shape->transitions);
+    break;
+  }
+  case OBJ_NATIVE:
+    if (nativeName(((ObjNative *)object)->function) == NULL)
+      writer->failed = true;
+    break;
+  case OBJ_STRING:
+  case OBJ_ROPE:
+    break;
+  }
+}
+
+// ropes are written out as the strings they spell
+static ObjType recordType(Obj *object) {
+  return object->type == OBJ_ROPE ? OBJ_STRING : object->type;
+}
+
+// renumbers the objects so each type's ids follow the previous type's
+static void groupByType(Writer *writer) {
+  Obj **grouped = malloc(sizeof(Obj *) * (writer->count + 1));
+  if (grouped == NULL) {
+    writer->failed = true;
+    return;
+  }
+
+  uint32_t next = 0;
+  for (int type = OBJ_STRING; type <= OBJ_SHAPE; type++) {
+    for (uint32_t i = 0; i < writer->count; i++) {
+      Obj *object = writer->objects[i];
+      if ((int)recordType(object) != type)
+        continue;
+      findId(writer, object)->id = next;
+      grouped[next++] = object;
+    }
+  }
+
+  free(writer->objects);
+  writer->objects = grouped;
+  writer->capacity = writer->count + 1;
+}
+
+static void writeBytes(Writer *writer, const void *bytes, size_t length) {
+  if (writer->failed)
+    return;
+  if (fwrite(bytes, 1, length, writer->file) != length)
+    writer->failed = true;
+}
+
+static void writeU8(Writer *writer, uint8_t value) {
+  writeBytes(writer, &value, 1);
+}
+
+static void writeU32(Writer *writer, uint32_t value) {
+  uint8_t bytes[4];
+  for (int i = 0; i < 4; i++) {
+    bytes[i] = (value >> (i * 8)) & 0xff;
+  }
+  writeBytes(writer, bytes, 4);
+}
+
+static void writeU64(Writer *writer, uint64_t value) {
+  uint8_t bytes[8];
+  for (int i = 0; i < 8; i++) {
+    bytes[i] = (value >> (i * 8)) & 0xff;
+  }
+  writeBytes(writer, bytes, 8);
+}
+
+static void writeId(Writer *writer, Obj *object) {
+  writeU32(writer, object == NULL ? NO_OBJECT : findId(writer, object)->id);
+}
+
+static void writeValue(Writer *writer, Value value) {
+  if (IS_NIL(value)) {
+    writeU8(writer, VALUE_NIL);
+  } else if (IS_BOOL(value)) {
+    writeU8(writer, AS_BOOL(value) ? VALUE_TRUE : VALUE_FALSE);
+  } else if (IS_NUMBER(value)) {
+    double number = AS_NUMBER(value);
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    writeU8(writer, VALUE_NUMBER);
+    writeU64(writer, bits);
+  } else {
+    writeU8(writer, VALUE_OBJECT);
+    writeId(writer, AS_OBJ(value));
+  }
+}
+
+static void writeTable(Writer *writer, Table *table) {
+  uint32_t count = 0;
+  for (int i = 0; i < table->capacity; i++) {
+    if (table->entries[i].key != NULL)
+      count++;
+  }
+
+  writeU32(writer, count);
+  for (int i = 0; i < table->capacity; i++) {
+    Entry *entry = &table->entries[i];
+    if (entry->key == NULL)
+      continue;
+    writeId(writer, (Obj *)entry->key);
+    writeValue(writer, entry->value);
+  }
+}
+
+static void writePiece(ObjString *piece, void *context) {
+  writeBytes((Writer *)context, piece->chars, piece->length);
+}
+
+static void writeObject(Writer *writer, Obj *object) {
+  writeU8(writer, (uint8_t)recordType(object));
+
+  switch (object->type) {
+  case OBJ_STRING: {
+    ObjString *string = (ObjString *)object;
+    writeU32(writer, (uint32_t)string->length);
+    writeBytes(writer, string->chars, string->length);
+    break;
+  }
+  case OBJ_ROPE: {
+    ObjRope *rope = (ObjRope *)object;
+    writeU32(writer, (uint32_t)rope->length);
+    visitRope(rope, writePiece, writer);
+    break;
+  }
+  case OBJ_FUNCTION: {
+    ObjFunction *function = (ObjFunction *)object;
+    Chunk *chunk = &function->chunk;
+    writeId(writer, (Obj *)function->name);
+    writeU32(writer, (uint32_t)function->arity);
+    writeU32(writer, (uint32_t)function->upvalueCount);
+    writeU32(writer, (uint32_t)chunk->count);
+    writeBytes(writer, chunk->code, chunk->count);
+    for (int i = 0; i < chunk->count; i++) {
+      writeU32(writer, (uint32_t)chunk->lines[i]);
+    }
+    writeU32(writer, (uint32_t)chunk->cacheCount);
+    writeU32(writer, (uint32_t)chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+      writeValue(writer, chunk->constants.values[i]);
+    }
+    break;
+  }
+  case OBJ_NATIVE: {
+    const char *name = nativeName(((ObjNative *)object)->function);
+    writeU32(writer, (uint32_t)strlen(name));
+    writeBytes(writer, name, strlen(name));
+    break;
+  }
+  case OBJ_CLOSURE: {
+    ObjClosure *closure = (ObjClosure *)object;
+    writeId(writer, (Obj *)closure->function);
+    writeU32(writer, (uint32_t)closure->upvalueCount);
+    for (int i = 0; i < closure->upvalueCount; i++) {
+      writeId(writer, (Obj *)closure->upvalues[i]);
+    }
+    break;
+  }
+  case OBJ_UPVALUE:
+    writeValue(writer, ((ObjUpvalue *)object)->closed);
+    break;
+  case OBJ_CLASS: {
+    ObjClass *klass = (ObjClass *)object;
+    writeId(writer, (Obj *)klass->name);
+    writeId(writer, (Obj *)klass->rootShape);
+    writeTable(writer, &klass->methods);
+    break;
+  }
+  case OBJ_INSTANCE: {
+    ObjInstance *instance = (ObjInstance *)object;
+    int fieldCount = instance->shape == NULL ? 0 : instance->shape->fieldCount;
+    writeId(writer, (Obj *)instance->className);
+    writeId(writer, (Obj *)instance->shape);
+    writeU32(writer, (uint32_t)fieldCount);
+    for (int i = 0; i < fieldCount; i++) {
+      writeValue(writer, instance->fields[i]);
+    }
+    writeTable(writer, &instance->dictionary);
+    break;
+  }
+  case OBJ_BOUND_METHOD: {
+    ObjBoundMethod *bound = (ObjBoundMethod *)object;
+    writeValue(writer, bound->receiver);
+    writeId(writer, (Obj *)bound->method);
+    break;
+  }
+  case OBJ_SHAPE: {
+    ObjShape *shape = (ObjShape *)object;
+    writeId(writer, (Obj *)shape->parent);
+    writeId(writer, (Obj *)shape->name);
+    writeU32(writer, (uint32_t)shape->fieldCount);
+    writeTable(writer, &shape->transitions);
+    break;
+  }
+  }
+}
+
+// writes everything reachable from the globals to path. Only possible
+// between scripts, while nothing lives on the stack
+bool saveSnapshot(const char *path) {
+  if (vm.frameCount != 0 || vm.openUpvalues != NULL)
+    return false;
+
+  Writer writer;
+  memset(&writer, 0, sizeof(writer));
+  for (int i = 0; i < vm.globalCount; i++) {
+    addObject(&writer, (Obj *)vm.globals[i].name);
+    addValue(&writer, vm.globals[i].value);
+  }
+  for (uint32_t i = 0; i < writer.count && !writer.failed; i++) {
+    addReferences(&writer, writer.objects[i]);
+  }
+  if (!writer.failed)
+    groupByType(&writer);
+
+  char temporary[4096];
+  int length =
+      snprintf(temporary, sizeof(temporary), "%s.%d.tmp", path, getpid());
+  if (writer.failed || length < 0 || length >= (int)sizeof(temporary)) {
+    writer.failed = true;
+  } else {
+    writer.file = fopen(temporary, "wb");
+    writer.failed = writer.file == NULL;
+  }
+
+  if (writer.file != NULL) {
+    writeBytes(&writer, SNAPSHOT_MAGIC, 4);
+    writeU32(&writer, SNAPSHOT_VERSION);
+    writeU32(&writer, writer.count);
+    for (uint32_t i = 0; i < writer.count; i++) {
+      writeObject(&writer, writer.objects[i]);
+    }
+
+    writeU32(&writer, (uint32_t)vm.globalCount);
+    for (int i = 0; i < vm.globalCount; i++) {
+      writeId(&writer, (Obj *)vm.globals[i].name);
+      writeU8(&writer, vm.globals[i].isDefined);
+      writeValue(&writer, vm.globals[i].value);
+    }
+
+    if (fclose(writer.file) != 0)
+      writer.failed = true;
+    if (writer.failed || rename(temporary, path) != 0) {
+      remove(temporary);
+      writer.failed = true;
+    }
+  }
+
+  free(writer.objects);
+  free(writer.ids);
+  return !writer.failed;
+}
+
+static const uint8_t *readBytes(Reader *reader, size_t length) {
+  if (reader->failed || reader->length - reader->position < length) {
+    reader->failed = true;
+    return NULL;
+  }
+  const uint8_t *bytes = reader->bytes + reader->position;
+  reader->position += length;
+  return bytes;
+}
+
+static uint8_t readU8(Reader *reader) {
+  const uint8_t *bytes = readBytes(reader, 1);
+  return bytes == NULL ? 0 : *bytes;
+}
+
+static uint32_t readU32(Reader *reader) {
+  const uint8_t *bytes = readBytes(reader, 4);
+  if (bytes == NULL)
+    return 0;
+
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    value |= (uint32_t)bytes[i] << (i * 8);
+  }
+  return value;
+}
+
+static uint64_t readU64(Reader *reader) {
+  const uint8_t *bytes = readBytes(reader, 8);
+  if (bytes == NULL)
+    return 0;
+
+  uint64_t value = 0;
+  for (int i = 0; i < 8; i++) {
+    value |= (uint64_t)bytes[i] << (i * 8);
+  }
+  return value;
+}
+
+// the restored object an id stands for, NULL for NO_OBJECT. Anything that
+// doesn't exist yet or has the wrong type fails the restore
+static Obj *readReference(Reader *reader, ObjType type) {
+  uint32_t id = readU32(reader);
+  if (reader->failed || id == NO_OBJECT)
+    return NULL;
+
+  if (id >= reader->count || reader->objects[id] == NULL ||
+      reader->objects[id]->type != type) {
+    reader->failed = true;
+    return NULL;
+  }
+  return reader->objects[id];
+}
+
+static Obj *readRequired(Reader *reader, ObjType type) {
+  Obj *object = readReference(reader, type);
+  if (object == NULL)
+    reader->failed = true;
+  return object;
+}
+
+// references are only followed when link is set, the first pass over the
+// objects just steps over them
+static Value readValue(Reader *reader, bool link) {
+  switch (readU8(reader)) {
+  case VALUE_NIL:
+    return NIL_VAL;
+  case VALUE_FALSE:
+    return BOOL_VAL(false);
+  case VALUE_TRUE:
+    return BOOL_VAL(true);
+  case VALUE_NUMBER: {
+    uint64_t bits = readU64(reader);
+    double number;
+    memcpy(&number, &bits, sizeof(number));
+    return NUMBER_VAL(number);
+  }
+  case VALUE_OBJECT: {
+    uint32_t id = readU32(reader);
+    if (!link || reader->failed)
+      return NIL_VAL;
+    if (id >= reader->count || reader->objects[id] == NULL) {
+      reader->failed = true;
+      return NIL_VAL;
+    }
+    return OBJ_VAL(reader->objects[id]);
+  }
+  default:
+    reader->failed = true;
+    return NIL_VAL;
+  }
+}
+
+static void readTable(Reader *reader, Table *table, bool link) {
+  uint32_t count = readU32(reader);
+  for (uint32_t i = 0; i < count && !reader->failed; i++) {
+    if (!link) {
+      readU32(reader);
+      readValue(reader, false);
+      continue;
+    }
+
+    ObjString *key = (ObjString *)readRequired(reader, OBJ_STRING);
+    Value value = readValue(reader, true);
+    if (!reader->failed)
+      tableSet(table, key, value);
+  }
+}
+
+// the first pass allocates each object with its scalar fields and leaves
+// its references NULL, which the GC can mark at any point. The second pass
+// reads the same record again and links it to the other objects
+static void readObject(Reader *reader, uint32_t id, bool link) {
+  ObjType type = (ObjType)readU8(reader);
+  Obj *object = reader->objects[id];
+  if (reader->failed || (link && object->type != type)) {
+    reader->failed = true;
+    return;
+  }
+
+  switch (type) {
+  case OBJ_STRING: {
+    uint32_t length = readU32(reader);
+    const uint8_t *chars = readBytes(reader, length);
+    if (!link && chars != NULL && length <= INT32_MAX) {
+      reader->objects[id] = (Obj *)copyString((const char *)chars, length);
+    }
+    break;
+  }
+  case OBJ_FUNCTION: {
+    ObjFunction *function = (ObjFunction *)object;
+    if (!link) {
+      function = newFunction();
+      reader->objects[id] = (Obj *)function;
+    }
+    Chunk *chunk = &function->chunk;
+
+    ObjString *name = (ObjString *)readReference(reader, OBJ_STRING);
+    int arity = (int)readU32(reader);
+    int upvalueCount = (int)readU32(reader);
+    uint32_t count = readU32(reader);
+    const uint8_t *code = readBytes(reader, count);
+    if (code == NULL || count > INT32_MAX / sizeof(int)) {
+      reader->failed = true;
+      return;
+    }
+
+    if (!link) {
+      function->arity = arity;
+      function->upvalueCount = upvalueCount;
+      chunk->code = ALLOCATE(uint8_t, count);
+      chunk->lines = ALLOCATE(int, count);
+      chunk->capacity = (int)count;
+      chunk->count = (int)count;
+      memcpy(chunk->code, code, count);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      int line = (int)readU32(reader);
+      if (!link)
+        chunk->lines[i] = line;
+    }
+
+    uint32_t cacheCount = readU32(reader);
+    uint32_t constantCount = readU32(reader);
+    if (cacheCount > UINT16_MAX + 1 || constantCount > UINT8_COUNT) {
+      reader->failed = true;
+      return;
+    }
+
+    if (!link) {
+      for (uint32_t i = 0; i < cacheCount; i++) {
+        addInlineCache(chunk);
+      }
+    } else {
+      function->name = name;
+    }
+
+    for (uint32_t i = 0; i < constantCount && !reader->failed; i++) {
+      Value constant = readValue(reader, link);
+      if (link)
+        writeValueArray(&chunk->constants, constant);
+    }
+
+    if (link && !reader->failed &&
+        !relocateGlobals(chunk, reader->slots, reader->slotCount)) {
+      reader->failed = true;
+    }
+    break;
+  }
+  case OBJ_NATIVE: {
+    uint32_t length = readU32(reader);
+    const uint8_t *name = readBytes(reader, length);
+    if (link || name == NULL)
+      break;
+
+    NativeFn native = findNative((const char *)name, (int)length);
+    if (native == NULL) {
+      reader->failed = true;
+      break;
+    }
+    reader->objects[id] = (Obj *)newNative(native);
+    break;
+  }
+  case OBJ_CLOSURE: {
+    ObjFunction *function =
+        (ObjFunction *)readRequired(reader, OBJ_FUNCTION);
+    uint32_t count = readU32(reader);
+    if (reader->failed || (int)count != function->upvalueCount) {
+      reader->failed = true;
+      break;
+    }
+
+    ObjClosure *closure = (ObjClosure *)object;
+    if (!link) {
+      closure = newClosure(function);
+      reader->objects[id] = (Obj *)closure;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      if (!link) {
+        readU32(reader);
+        continue;
+      }
+      closure->upvalues[i] = (ObjUpvalue *)readRequired(reader, OBJ_UPVALUE);
+    }
+    break;
+  }
+  case OBJ_UPVALUE: {
+    Value closed = readValue(reader, link);
+    if (!link) {
+      ObjUpvalue *upvalue = newUpvalue(NULL);
+      upvalue->location = &upvalue->closed;
+      reader->objects[id] = (Obj *)upvalue;
+    } else {
+      ((ObjUpvalue *)object)->closed = closed;
+    }
+    break;
+  }
+  case OBJ_CLASS: {
+    ObjString *name = (ObjString *)readRequired(reader, OBJ_STRING);
+    if (!link) {
+      readU32(reader);
+      if (!reader->failed)
+        reader->objects[id] = (Obj *)newClass(name);
+      readTable(reader, NULL, false);
+      break;
+    }
+
+    ObjClass *klass = (ObjClass *)object;
+    klass->rootShape = (ObjShape *)readRequired(reader, OBJ_SHAPE);
+    readTable(reader, &klass->methods, true);
+    // the vtable is not stored, it is rebuilt from the methods
+    for (int i = 0; i < klass->methods.capacity && !reader->failed; i++) {
+      Entry *entry = &klass->methods.entries[i];
+      if (entry->key == NULL)
+        continue;
+      if (!IS_CLOSURE(entry->value)) {
+        reader->failed = true;
+        break;
+      }
+      vtableSet(klass, entry->key, AS_CLOSURE(entry->value));
+    }
+    break;
+  }
+  case OBJ_INSTANCE: {
+    ObjClass *klass = (ObjClass *)readRequired(reader, OBJ_CLASS);
+    ObjInstance *instance = (ObjInstance *)object;
+    ObjShape *shape = NULL;
+
+    if (!link) {
+      readU32(reader);
+      if (reader->failed)
+        break;
+      // dictionary mode until the second pass links the shape
+      instance = newInstance(klass);
+      instance->shape = NULL;
+      reader->objects[id] = (Obj *)instance;
+    } else {
+      shape = (ObjShape *)readReference(reader, OBJ_SHAPE);
+    }
+
+    uint32_t fieldCount = readU32(reader);
+    if (reader->failed || fieldCount > SHAPE_MAX_FIELDS ||
+        (link && (shape == NULL ? 0 : shape->fieldCount) != (int)fieldCount)) {
+      reader->failed = true;
+      break;
+    }
+
+    if (!link && fieldCount > 0) {
+      reserveFields(instance, (int)fieldCount);
+      for (uint32_t i = 0; i < fieldCount; i++) {
+        instance->fields[i] = NIL_VAL;
+      }
+    }
+    for (uint32_t i = 0; i < fieldCount; i++) {
+      Value field = readValue(reader, link);
+      if (link)
+        instance->fields[i] = field;
+    }
+    if (link && !reader->failed)
+      instance->shape = shape;
+
+    readTable(reader, &instance->dictionary, link);
+    break;
+  }
+  case OBJ_BOUND_METHOD: {
+    Value receiver = readValue(reader, link);
+    if (!link) {
+      readU32(reader);
+      reader->objects[id] = (Obj *)newBoundMethod(NIL_VAL, NULL);
+      break;
+    }
+
+    ObjBoundMethod *bound = (ObjBoundMethod *)object;
+    bound->receiver = receiver;
+    bound->method = (ObjClosure *)readRequired(reader, OBJ_CLOSURE);
+    break;
+  }
+  case OBJ_SHAPE: {
+    if (!link) {
+      readU32(reader);
+      readU32(reader);
+      uint32_t fieldCount = readU32(reader);
+      if (fieldCount > SHAPE_MAX_FIELDS) {
+        reader->failed = true;
+        break;
+      }
+      ObjShape *shape = newShape(NULL, NULL);
+      shape->fieldCount = (int)fieldCount;
+      reader->objects[id] = (Obj *)shape;
+      readTable(reader, NULL, false);
+      break;
+    }
+
+    ObjShape *shape = (ObjShape *)object;
+    shape->parent = (ObjShape *)readReference(reader, OBJ_SHAPE);
+    shape->name = (ObjString *)readReference(reader, OBJ_STRING);
+    uint32_t fieldCount = readU32(reader);
+    // field counts grow by one down the tree, which also rules out cycles
+    int expected = shape->parent == NULL ? 0 : shape->parent->fieldCount + 1;
+    if ((int)fieldCount != expected || (shape->parent == NULL) !=
+                                           (shape->name == NULL)) {
+      reader->failed = true;
+      break;
+    }
+    readTable(reader, &shape->transitions, true);
+    break;
+  }
+  default:
+    reader->failed = true;
+    break;
+  }
+
+  if (!link && !reader->failed && reader->objects[id] == NULL)
+    reader->failed = true;
+}
+
+// the globals section is read once for the slots the code gets relocated
+// to and again, after every object is linked, for the values
+static void readGlobals(Reader *reader, bool assign) {
+  uint32_t count = readU32(reader);
+  if (reader->failed || count > UINT16_MAX + 1) {
+    reader->failed = true;
+    return;
+  }
+
+  if (!assign) {
+    reader->slots = malloc(sizeof(int) * (count + 1));
+    reader->slotCount = (int)count;
+    if (reader->slots == NULL) {
+      reader->failed = true;
+      return;
+    }
+  }
+
+  for (uint32_t i = 0; i < count && !reader->failed; i++) {
+    ObjString *name = (ObjString *)readRequired(reader, OBJ_STRING);
+    bool isDefined = readU8(reader) != 0;
+    Value value = readValue(reader, true);
+    if (reader->failed)
+      return;
+
+    if (!assign) {
+      reader->slots[i] = globalSlot(name);
+    } else {
+      GlobalVar *global = &vm.globals[reader->slots[i]];
+      global->value = value;
+      global->isDefined = isDefined;
+    }
+  }
+}
+
+static char *readFile(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+    return NULL;
+
+  fseek(file, 0L, SEEK_END);
+  long fileSize = ftell(file);
+  rewind(file);
+
+  char *bytes = fileSize < 0 ? NULL : malloc((size_t)fileSize + 1);
+  if (bytes == NULL ||
+      fread(bytes, 1, (size_t)fileSize, file) != (size_t)fileSize) {
+    free(bytes);
+    fclose(file);
+    return NULL;
+  }
+
+  fclose(file);
+  *size = (size_t)fileSize;
+  return bytes;
+}
+
+// rebuilds a snapshot's heap and globals in this VM, meant for a fresh VM
+// before any script runs. Strings are interned again on the way in
+bool restoreSnapshot(const char *path) {
+  size_t size;
+  char *bytes = readFile(path, &size);
+  if (bytes == NULL)
+    return false;
+
+  Reader reader;
+  memset(&reader, 0, sizeof(reader));
+  reader.bytes = (const uint8_t *)bytes;
+  reader.length = size;
+
+  const uint8_t *magic = readBytes(&reader, 4);
+  if (magic == NULL || memcmp(magic, SNAPSHOT_MAGIC, 4) != 0 ||
+      readU32(&reader) != SNAPSHOT_VERSION) {
+    free(bytes);
+    return false;
+  }
+
+  reader.count = readU32(&reader);
+  // every object takes at least a byte, which bounds the id table
+  if (reader.failed || reader.count > reader.length) {
+    free(bytes);
+    return false;
+  }
+  reader.objects = calloc(reader.count + 1, sizeof(Obj *));
+  if (reader.objects == NULL) {
+    free(bytes);
+    return false;
+  }
+
+  restoring = &reader;
+  size_t objectsStart = reader.position;
+  for (uint32_t i = 0; i < reader.count && !reader.failed; i++) {
+    readObject(&reader, i, false);
+  }
+
+  size_t globalsStart = reader.position;
+  readGlobals(&reader, false);
+
+  reader.position = objectsStart;
+  for (uint32_t i = 0; i < reader.count && !reader.failed; i++) {
+    readObject(&reader, i, true);
+  }
+
+  if (!reader.failed) {
+    reader.position = globalsStart;
+    readGlobals(&reader, true);
+  }
+
+  // everything was linked without barriers while the restore kept it
+  // alive. Objects promoted meanwhile may point at young ones, and ones
+  // already blackened by an incremental collection at white ones
+  for (uint32_t i = 0; i < reader.count; i++) {
+    if (reader.objects[i] == NULL)
+      continue;
+    rememberObject(reader.objects[i]);
+    if (vm.gcMarking)
+      markObject(reader.objects[i]);
+  }
+  restoring = NULL;
+
+  bool restored = !reader.failed && reader.position == reader.length;
+  free(reader.slots);
+  free(reader.objects);
+  free(bytes);
+  return restored;
+}
+
+void markSnapshotRoots() {
+  if (restoring == NULL)
+    return;
+
+  for (uint32_t i = 0; i < restoring->count; i++) {
+    markObject(restoring->objects[i]);
+  }
+}
@@ -5,100 +5,247 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define TABLE_MAX_LOAD 0.75
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// full slots may take up 7/8 of the table
+#define TABLE_MAX_LOAD(capacity) ((capacity) / 8 * 7)
+
+#define GROUP_WIDTH 16
+// a full slot's control byte is the low 7 bits of its hash, the others
+// have the high bit set
+#define CONTROL_EMPTY 0x80
+#define CONTROL_DELETED 0xfe
 
 void initTable(Table *table) {
   table->count = 0;
+  table->tombstones = 0;
   table->capacity = 0;
+  table->control = NULL;
   table->entries = NULL;
 }
 
 void freeTable(Table *table) {
+  FREE_ARRAY(uint8_t, table->control, table->capacity);
   FREE_ARRAY(Entry, table->entries, table->capacity);
   initTable(table);
 }
 
-// liner probing to find value
-static Entry *findEntry(Entry *entries, int capacity, ObjString *key) {
-  uint32_t index = key->hash % capacity;
-  Entry *tombstone = NULL;
-  for (;;) {
-    Entry *entry = &entries[index];
-    if (entry->key == NULL) {
-      if (IS_NIL(entry->value)) {
-        return tombstone != NULL ? tombstone : entry;
-      } else {
-        if (tombstone == NULL)
-          tombstone = entry;
-      }
-
-    } else if (entry->key == key) {
-      return entry;
+static inline uint8_t hashTag(uint32_t hash) { return hash & 0x7f; }
+
+// bit i is set when the group's i-th control byte matches
+#if defined(__SSE2__)
+static inline uint32_t matchByte(const uint8_t *group, uint8_t byte) {
+  __m128i control = _mm_loadu_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(control, _mm_set1_epi8((char)byte)));
+}
+
+// empty and deleted slots, the only ones with the high bit set
+static inline uint32_t matchFree(const uint8_t *group) {
+  return (uint32_t)_mm_movemask_epi8(
+      _mm_loadu_si128((const __m128i *)group));
+}
+#else
+static inline uint32_t matchByte(const uint8_t *group, uint8_t byte) {
+  uint32_t mask = 0;
+  for (int i = 0; i < GROUP_WIDTH; i++) {
+    mask |= (uint32_t)(group[i] == byte) << i;
+  }
+  return mask;
+}
+
+static inline uint32_t matchFree(const uint8_t *group) {
+  uint32_t mask = 0;
+  for (int i = 0; i < GROUP_WIDTH; i++) {
+    mask |= (uint32_t)(group[i] >> 7) << i;
+  }
+  return mask;
+}
+#endif
+
+// probes the groups at triangular offsets, which visits every group of a
+// power of two table once
+#define FOR_EACH_GROUP(capacity, hash, group)                                  \
+  for (int mask_ = (capacity) / GROUP_WIDTH - 1, step_ = 0,                    \
+           group = ((hash) >> 7) & mask_;                                      \
+       step_ <= mask_; group = (group + ++step_) & mask_)
+
+#define FOR_EACH_BIT(bits, bit)                                                \
+  for (int bit; (bits) != 0 && ((bit = __builtin_ctz(bits)), true);           \
+       (bits) &= (bits) - 1)
+
+static Entry *findEntry(Table *table, ObjString *key) {
+  if (table->capacity == 0)
+    return NULL;
+
+  uint8_t tag = hashTag(key->hash);
+  FOR_EACH_GROUP(table->capacity, key->hash, group) {
+    const uint8_t *control = &table->control[group * GROUP_WIDTH];
+    uint32_t matches = matchByte(control, tag);
+    FOR_EACH_BIT(matches, bit) {
+      Entry *entry = &table->entries[group * GROUP_WIDTH + bit];
+      if (entry->key == key)
+        return entry;
     }
-    index = (index + 1) % capacity;
+    // a probe never continues past a group that still has an empty slot
+    if (matchByte(control, CONTROL_EMPTY) != 0)
+      return NULL;
   }
+  return NULL;
+}
+
+// the first empty or deleted slot on the key's probe sequence
+static int findFreeSlot(uint8_t *control, int capacity, uint32_t hash) {
+  FOR_EACH_GROUP(capacity, hash, group) {
+    uint32_t slots = matchFree(&control[group * GROUP_WIDTH]);
+    if (slots != 0)
+      return group * GROUP_WIDTH + __builtin_ctz(slots);
+  }
+  return -1;
+}
+
+// the smallest capacity that holds count entries at half the maximum load,
+// leaving room to grow before the next rehash
+static int capacityFor(int count) {
+  int capacity = GROUP_WIDTH;
+  while (count > capacity / 2) {
+    capacity *= 2;
+  }
+  return capacity;
 }
 
 static void adjustCapacity(Table *table, int capacity) {
-  // allocate memory
+  uint8_t *control = ALLOCATE(uint8_t, capacity);
   Entry *entries = ALLOCATE(Entry, capacity);
-
-  // initialize all entries to null
+  memset(control, CONTROL_EMPTY, capacity);
   for (int i = 0; i < capacity; i++) {
     entries[i].key = NULL;
     entries[i].value = NIL_VAL;
   }
 
-  // copy over values from old map
+  // tombstones are left behind
   table->count = 0;
+  table->tombstones = 0;
   for (int i = 0; i < table->capacity; i++) {
     Entry *entry = &table->entries[i];
     if (entry->key == NULL)
       continue;
 
-    Entry *dest = findEntry(entries, capacity, entry->key);
-    dest->key = entry->key;
-    dest->value = entry->value;
+    int slot = findFreeSlot(control, capacity, entry->key->hash);
+    control[slot] = hashTag(entry->key->hash);
+    entries[slot] = *entry;
     table->count++;
   }
 
-  // update capacity, add new array pointer and free old array
+  FREE_ARRAY(uint8_t, table->control, table->capacity);
   FREE_ARRAY(Entry, table->entries, table->capacity);
+  table->control = control;
   table->entries = entries;
   table->capacity = capacity;
 }
 
+// rehashes without allocating, every tombstone becomes empty. Full slots
+// are marked deleted first and then moved, one at a time, to the first
+// free slot on their probe sequence. Whatever still marked deleted sits
+// there is swapped back and placed next
+static void dropTombstones(Table *table) {
+  uint8_t *control = table->control;
+  for (int i = 0; i < table->capacity; i++) {
+    control[i] = control[i] == CONTROL_DELETED ? CONTROL_EMPTY
+                 : control[i] == CONTROL_EMPTY ? CONTROL_EMPTY
+                                               : CONTROL_DELETED;
+  }
+
+  for (int i = 0; i < table->capacity; i++) {
+    if (control[i] != CONTROL_DELETED)
+      continue;
+
+    Entry *entry = &table->entries[i];
+    uint32_t hash = entry->key->hash;
+    int slot = findFreeSlot(control, table->capacity, hash);
+    // a lookup finds it in its own group all the same
+    if (slot / GROUP_WIDTH == i / GROUP_WIDTH) {
+      control[i] = hashTag(hash);
+      continue;
+    }
+
+    Entry moved = *entry;
+    if (control[slot] == CONTROL_EMPTY) {
+      control[i] = CONTROL_EMPTY;
+      entry->key = NULL;
+      entry->value = NIL_VAL;
+    } else {
+      *entry = table->entries[slot];
+      i--;
+    }
+    control[slot] = hashTag(hash);
+    table->entries[slot] = moved;
+  }
+  table->tombstones = 0;
+}
+
 bool tableSet(Table *table, ObjString *key, Value value) {
+  Entry *entry = findEntry(table, key);
+  if (entry != NULL) {
+    entry->value = value;
+    return false;
+  }
 
-  // check if load factor threshold is crossing and if so grow map
-  // load = count / capacity so this works as a check
-  if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-    int capacity = GROW_CAPACITY(table->capacity);
-    adjustCapacity(table, capacity);
+  // tombstones count against the load since they don't end a probe. Once
+  // they make up most of it the table is rehashed at the same size, and a
+  // table left mostly empty by deletions shrinks
+  if (table->count + table->tombstones + 1 >
+      TABLE_MAX_LOAD(table->capacity)) {
+    if (table->count + 1 <= table->capacity / 2) {
+      dropTombstones(table);
+    } else {
+      adjustCapacity(table, capacityFor(table->count + 1));
+    }
+  } else if (table->capacity > GROUP_WIDTH &&
+             table->count < table->capacity / 8) {
+    adjustCapacity(table, capacityFor(table->count + 1));
   }
 
-  // check for existing intries of given key
-  Entry *entry = findEntry(table->entries, table->capacity, key);
-  bool isNewKey = entry->key == NULL;
-  if (isNewKey && IS_NIL(entry->value))
-    table->count++;
+  int slot = findFreeSlot(table->control, table->capacity, key->hash);
+  if (table->control[slot] == CONTROL_DELETED)
+    table->tombstones--;
+  table->count++;
+  table->control[slot] = hashTag(key->hash);
+  table->entries[slot].key = key;
+  table->entries[slot].value = value;
+  return true;
+}
 
-  entry->key = key;
-  entry->value = value;
-  return isNewKey;
+static void removeEntry(Table *table, Entry *entry) {
+  // a group with an empty slot has never been probed past, so its slot can
+  // go back to empty instead of becoming a tombstone
+  int slot = (int)(entry - table->entries);
+  uint8_t *group = &table->control[slot / GROUP_WIDTH * GROUP_WIDTH];
+  if (matchByte(group, CONTROL_EMPTY) != 0) {
+    table->control[slot] = CONTROL_EMPTY;
+  } else {
+    table->control[slot] = CONTROL_DELETED;
+    table->tombstones++;
+  }
+  table->count--;
+  entry->key = NULL;
+  entry->value = NIL_VAL;
 }
 
 bool tableDelete(Table *table, ObjString *key) {
-  if (table->count == 0)
+  Entry *entry = findEntry(table, key);
+  if (entry == NULL)
     return false;
 
-  // find
-  Entry *entry = findEntry(table->entries, table->capacity, key);
-  if (entry->key == NULL)
-    return false;
-
-  entry->key = NULL;
-  entry->value = BOOL_VAL(true);
+  removeEntry(table, entry);
+  if (table->count == 0) {
+    freeTable(table);
+  } else if (table->capacity > GROUP_WIDTH &&
+             table->count < table->capacity / 8) {
+    adjustCapacity(table, capacityFor(table->count));
+  }
   return true;
 }
 
@@ -112,30 +259,54 @@ void tableAddAll(Table *from, Table *to) {
 }
 
 bool tableGet(Table *table, ObjString *key, Value *value) {
-  if (table->count == 0)
-    return false;
-
-  Entry *entry = findEntry(table->entries, table->capacity, key);
-  if (entry->key == NULL)
+  Entry *entry = findEntry(table, key);
+  if (entry == NULL)
     return false;
 
   *value = entry->value;
   return true;
 }
 
+// the intern table lookup, by content since the string may not exist yet
+ObjString *tableFindString(Table *table, const char *chars, int length,
+                           uint32_t hash) {
+  if (table->count == 0)
+    return NULL;
+
+  uint8_t tag = hashTag(hash);
+  FOR_EACH_GROUP(table->capacity, hash, group) {
+    const uint8_t *control = &table->control[group * GROUP_WIDTH];
+    uint32_t matches = matchByte(control, tag);
+    FOR_EACH_BIT(matches, bit) {
+      ObjString *key = table->entries[group * GROUP_WIDTH + bit].key;
+      if (key->length == length && key->hash == hash &&
+          memcmp(key->chars, chars, length) == 0)
+        return key;
+    }
+    if (matchByte(control, CONTROL_EMPTY) != 0)
+      return NULL;
+  }
+  return NULL;
+}
+
 void markTable(Table *table) {
-  for (int i = 0; i < table->count; i++) {
+  for (int i = 0; i < table->capacity; i++) {
     Entry *entry = &table->entries[i];
     markObject((Obj *)entry->key);
     markValue(entry->value);
   }
 }
 
+// runs during a collection, so it may not allocate. The table is only
+// rehashed in place here, shrinking waits for the next insert
 void tableRemoveWhite(Table *table) {
   for (int i = 0; i < table->capacity; i++) {
     Entry *entry = &table->entries[i];
     if (entry->key != NULL && !entry->key->obj.isMarked) {
-      tableDelete(table, entry->key);
+      removeEntry(table, entry);
     }
   }
+  if (table->tombstones > table->count) {
+    dropTombstones(table);
+  }
 }
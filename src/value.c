@@ -27,6 +27,17 @@ void freeValueArray(ValueArray *array) {
 }
 
 void printValue(Value value) {
+#ifdef NAN_BOXING
+  if (IS_BOOL(value)) {
+    printf(AS_BOOL(value) ? "true" : "false");
+  } else if (IS_NIL(value)) {
+    printf("nil");
+  } else if (IS_NUMBER(value)) {
+    printf("%g", AS_NUMBER(value));
+  } else if (IS_OBJ(value)) {
+    printObject(value);
+  }
+#else
   switch (value.type) {
   case VAL_BOOL:
     printf(AS_BOOL(value) ? "true" : "false");
@@ -41,9 +52,20 @@ void printValue(Value value) {
     printObject(value);
     break;
   }
+#endif
 }
 
 bool valuesEqual(Value a, Value b) {
+#ifdef NAN_BOXING
+  // compare as doubles so NaN != NaN like the tagged representation does
+  if (IS_NUMBER(a) && IS_NUMBER(b)) {
+    return AS_NUMBER(a) == AS_NUMBER(b);
+  }
+  if (IS_STRING(a) && IS_STRING(b)) {
+    return stringsEqual(AS_STRING(a), AS_STRING(b));
+  }
+  return a == b;
+#else
   if (a.type != b.type)
     return false;
   switch (a.type) {
@@ -55,8 +77,12 @@ bool valuesEqual(Value a, Value b) {
   case VAL_NUMBER:
     return AS_NUMBER(a) == AS_NUMBER(b);
   case VAL_OBJ:
+    if (IS_STRING(a) && IS_STRING(b)) {
+      return stringsEqual(AS_STRING(a), AS_STRING(b));
+    }
     return AS_OBJ(a) == AS_OBJ(b);
   default:
     return false;
   }
+#endif
 }
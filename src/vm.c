@@ -2,6 +2,8 @@
 #include "../include/chunk.h"
 #include "../include/compiler.h"
 #include "../include/debug.h"
+#include "../include/jit.h"
+#include "../include/loxc.h"
 #include "../include/memory.h"
 #include "../include/object.h"
 #include "../include/value.h"
@@ -17,6 +19,44 @@
 
 VM vm;
 
+#ifdef DEBUG_COUNT_DISPATCH
+static uint64_t dispatchCount = 0;
+#endif
+
+#ifdef DEBUG_COUNT_PAIRS
+// how often each opcode was dispatched right after another one, used to
+// pick which sequences are worth a superinstruction
+static uint64_t pairCounts[UINT8_COUNT][UINT8_COUNT];
+static uint8_t previousOp = OP_RETURN;
+
+static void countPair(uint8_t op) {
+  pairCounts[previousOp][op]++;
+  previousOp = op;
+}
+
+static void printPairs() {
+  fprintf(stderr, "most frequent opcode pairs\n");
+  for (int rank = 0; rank < 20; rank++) {
+    int first = 0;
+    int second = 0;
+    for (int i = 0; i < UINT8_COUNT; i++) {
+      for (int j = 0; j < UINT8_COUNT; j++) {
+        if (pairCounts[i][j] > pairCounts[first][second]) {
+          first = i;
+          second = j;
+        }
+      }
+    }
+
+    if (pairCounts[first][second] == 0) break;
+    fprintf(stderr, "%12llu  %-20s %s\n",
+            (unsigned long long)pairCounts[first][second], opcodeName(first),
+            opcodeName(second));
+    pairCounts[first][second] = 0;
+  }
+}
+#endif
+
 static void resetStack() {
   vm.stackTop = vm.stack;
   vm.openUpvalues = NULL;
@@ -37,12 +77,68 @@ static Value clockNative(int argCount, Value *args) {
   return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
 }
 
+typedef struct {
+  const char *name;
+  NativeFn function;
+} NativeEntry;
+
+// every native defined in a new VM, snapshots refer to natives by name
+static const NativeEntry natives[] = {
+    {"clock", clockNative},
+};
+
+#define NATIVE_COUNT (int)(sizeof(natives) / sizeof(natives[0]))
+
+const char *nativeName(NativeFn function) {
+  for (int i = 0; i < NATIVE_COUNT; i++) {
+    if (natives[i].function == function)
+      return natives[i].name;
+  }
+  return NULL;
+}
+
+NativeFn findNative(const char *name, int length) {
+  for (int i = 0; i < NATIVE_COUNT; i++) {
+    if ((int)strlen(natives[i].name) == length &&
+        memcmp(natives[i].name, name, length) == 0)
+      return natives[i].function;
+  }
+  return NULL;
+}
+
+// slot of a global name, giving it a new undefined slot the first time
+int globalSlot(ObjString *name) {
+  Value index;
+  if (tableGet(&vm.globalNames, name, &index)) {
+    return (int)AS_NUMBER(index);
+  }
+
+  push(OBJ_VAL(name));
+  if (vm.globalCapacity < vm.globalCount + 1) {
+    int oldCapacity = vm.globalCapacity;
+    vm.globalCapacity = GROW_CAPACITY(oldCapacity);
+    vm.globals =
+        GROW_ARRAY(GlobalVar, vm.globals, oldCapacity, vm.globalCapacity);
+  }
+
+  GlobalVar *global = &vm.globals[vm.globalCount];
+  global->name = name;
+  global->value = NIL_VAL;
+  global->isDefined = false;
+  tableSet(&vm.globalNames, name, NUMBER_VAL(vm.globalCount));
+  pop();
+  return vm.globalCount++;
+}
+
 static void defineNative(const char *name, NativeFn function) {
   // shove function name and object to stack
   push(OBJ_VAL(copyString(name, (int)strlen(name))));
   push(OBJ_VAL(newNative(function)));
 
-  tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+  int slot = globalSlot(AS_STRING(vm.stack[0]));
+  GlobalVar *global = &vm.globals[slot];
+  global->value = vm.stack[1];
+  global->isDefined = true;
   pop();
   pop();
 }
@@ -50,23 +146,54 @@ static void defineNative(const char *name, NativeFn function) {
 void initVM() {
   resetStack();
   vm.objects = NULL;
-  initTable(&vm.strings);
-  initTable(&vm.globals);
-  vm.initString = NULL;
-  vm.initString = copyString("init", 4);
-  defineNative("clock", clockNative);
+  vm.oldObjects = NULL;
+  vm.remembered = NULL;
+  vm.rememberedCount = 0;
+  vm.rememberedCapacity = 0;
   vm.grayCapacity = 0;
   vm.grayCount = 0;
   vm.grayStack = NULL;
   vm.bytesAllocated = 0;
   vm.nextGC = 1024 * 1024;
+  vm.nextMajorGC = 1024 * 1024;
+  vm.gcMarking = false;
+  vm.gcSliceBudget = GC_SLICE_BUDGET;
+  initTable(&vm.strings);
+  initTable(&vm.globalNames);
+  vm.globals = NULL;
+  vm.globalCount = 0;
+  vm.globalCapacity = 0;
+  vm.initString = NULL;
+  vm.selectorCount = 0;
+  vm.registerCode = false;
+#ifdef JIT_SUPPORTED
+  vm.jitEnabled = true;
+#else
+  vm.jitEnabled = false;
+#endif
+  vm.initString = copyString("init", 4);
+  for (int i = 0; i < NATIVE_COUNT; i++) {
+    defineNative(natives[i].name, natives[i].function);
+  }
 }
 
 void freeVM() {
+#ifdef DEBUG_COUNT_DISPATCH
+  fprintf(stderr, "dispatched %llu instructions\n",
+          (unsigned long long)dispatchCount);
+#endif
+#ifdef DEBUG_COUNT_PAIRS
+  printPairs();
+#endif
   freeTable(&vm.strings);
-  freeTable(&vm.globals);
+  freeTable(&vm.globalNames);
+  FREE_ARRAY(GlobalVar, vm.globals, vm.globalCapacity);
+  vm.globals = NULL;
+  vm.globalCount = 0;
+  vm.globalCapacity = 0;
   vm.initString = NULL;
   freeObjects();
+  freeBytecodeImages();
 }
 
 static Value peek(int distance) { return *(vm.stackTop - 1 - distance); }
@@ -121,9 +248,19 @@ static bool call(ObjClosure *closure, int argCount) {
   frame->closure = closure;
   frame->ip = closure->function->chunk.code;
   frame->slots = vm.stackTop - argCount - 1;
+  frame->isConstruction = false;
   return true;
 }
 
+// the fields an instance has once its constructor returns are what the
+// next one is allocated with. Following the latest instance lets one
+// outlier's fields go again
+static void recordFieldHint(Value result) {
+  ObjInstance *instance = AS_INSTANCE(result);
+  setFieldHint(instance->className,
+               instance->shape == NULL ? 0 : instance->shape->fieldCount);
+}
+
 static bool callValue(Value callee, int argCount) {
   if (IS_OBJ(callee)) {
     switch (OBJ_TYPE(callee)) {
@@ -139,9 +276,11 @@ static bool callValue(Value callee, int argCount) {
     case OBJ_CLASS: {
       ObjClass *className = AS_CLASS(callee);
       vm.stackTop[-argCount - 1] = OBJ_VAL(newInstance(className));
-      Value initializer;
-      if (tableGet(&className->methods, vm.initString, &initializer)) {
-        return call(AS_CLOSURE(initializer), argCount);
+      if (className->initializer != NULL) {
+        if (!call(className->initializer, argCount))
+          return false;
+        vm.frames[vm.frameCount - 1].isConstruction = true;
+        return true;
       } else if (argCount != 0) {
         runtimeError("Expected 0 arguments but got %d", argCount);
         return false;
@@ -163,22 +302,40 @@ static bool callValue(Value callee, int argCount) {
   return false;
 }
 
-static void concatenate() {
+// concatenations at least this long become ropes, so building a string in a
+// loop is linear and characters are only copied once
+#define ROPE_MIN_LENGTH 64
+
+void concatenate() {
+  int length = textLength(AS_OBJ(peek(1))) + textLength(AS_OBJ(peek(0)));
+  if (length >= ROPE_MIN_LENGTH) {
+    ObjRope *rope = newRope(AS_OBJ(peek(1)), AS_OBJ(peek(0)), length);
+    pop();
+    pop();
+    push(OBJ_VAL(rope));
+    return;
+  }
+
+  // both are flat, every rope is longer. The result is not interned,
+  // strings compare by content
+  ObjString *result = newString(length);
   ObjString *b = AS_STRING(peek(0));
   ObjString *a = AS_STRING(peek(1));
-
-  int length = a->length + b->length;
-  char *chars = ALLOCATE(char, length + 1);
-  memcpy(chars, a->chars, a->length);
-  memcpy(chars + a->length, b->chars, b->length);
-  chars[length] = '\0';
-
-  ObjString *result = takeString(chars, length);
+  memcpy(result->chars, a->chars, a->length);
+  memcpy(result->chars + a->length, b->chars, b->length);
   pop();
   pop();
   push(OBJ_VAL(result));
 }
 
+// replaces a rope on the stack with its flattened string
+static void flattenOperand(int distance) {
+  Value value = peek(distance);
+  if (IS_ROPE(value)) {
+    vm.stackTop[-1 - distance] = OBJ_VAL(flattenRope(AS_ROPE(value)));
+  }
+}
+
 static ObjUpvalue *captureUpvalues(Value *local) {
   ObjUpvalue *prevUpvalue = NULL;
   ObjUpvalue *upvalue = vm.openUpvalues;
@@ -205,99 +362,417 @@ static void defineMethod(ObjString *name) {
   Value method = peek(0);
   ObjClass *klass = AS_CLASS(peek(1));
   tableSet(&klass->methods, name, method);
+  writeBarrier((Obj *)klass, (Obj *)name);
+  writeBarrierValue((Obj *)klass, method);
+  vtableSet(klass, name, AS_CLOSURE(method));
+  pop();
+}
+
+// replaces the receiver on top of the stack with the method bound to it
+static void bindClosure(ObjClosure *method) {
+  ObjBoundMethod *bound = newBoundMethod(peek(0), method);
   pop();
+  push(OBJ_VAL(bound));
 }
 
 static bool bindMethod(ObjClass *klass, ObjString *name) {
-  Value method;
-  if (!tableGet(&klass->methods, name, &method)) {
+  ObjClosure *method = findMethod(klass, name);
+  if (method == NULL) {
     runtimeError("Undefined property '%s'.", name->chars);
     return false;
   }
-  ObjBoundMethod *bound = newBoundMethod(pop(), AS_CLOSURE(method));
-  push(OBJ_VAL(bound));
+  bindClosure(method);
   return true;
 }
 
+static inline InlineCacheEntry *findCacheEntry(InlineCache *cache,
+                                               ObjShape *shape) {
+  for (int i = 0; i < cache->count; i++) {
+    if (cache->entries[i].shape == shape)
+      return &cache->entries[i];
+  }
+  return NULL;
+}
+
+static void updateCache(InlineCache *cache, ObjShape *shape, int index,
+                        ObjClosure *method, ObjShape *transition) {
+  // instances in dictionary mode have no shape to key on
+  if (shape == NULL)
+    return;
+
+  InlineCacheEntry *entry = findCacheEntry(cache, shape);
+  if (entry == NULL) {
+    // once every way is taken the newest shape evicts the last one
+    entry = cache->count < INLINE_CACHE_WAYS
+                ? &cache->entries[cache->count++]
+                : &cache->entries[INLINE_CACHE_WAYS - 1];
+  }
+  entry->shape = shape;
+  entry->index = index;
+  entry->method = method;
+  entry->transition = transition;
+
+  // caches are only updated by the running function, which owns them
+  Obj *function = (Obj *)vm.frames[vm.frameCount - 1].closure->function;
+  writeBarrier(function, (Obj *)shape);
+  writeBarrier(function, (Obj *)method);
+  writeBarrier(function, (Obj *)transition);
+}
+
+static void inheritMethods(ObjClass *superClass, ObjClass *subClass) {
+  tableAddAll(&superClass->methods, &subClass->methods);
+  vtableInherit(superClass, subClass);
+  for (int i = 0; i < superClass->methods.capacity; i++) {
+    Entry *entry = &superClass->methods.entries[i];
+    if (entry->key == NULL)
+      continue;
+    writeBarrier((Obj *)subClass, (Obj *)entry->key);
+    writeBarrierValue((Obj *)subClass, entry->value);
+  }
+}
+
+static bool getProperty(ObjInstance *instance, ObjString *name,
+                        InlineCache *cache) {
+  // find variable in instance
+  Value field;
+  if (instanceGetField(instance, name, &field)) {
+    if (instance->shape != NULL) {
+      updateCache(cache, instance->shape,
+                  shapeFieldIndex(instance->shape, name), NULL, NULL);
+    }
+    vm.stackTop[-1] = field;
+    return true;
+  }
+
+  // find method in class & bind it if found
+  ObjClosure *method = findMethod(instance->className, name);
+  if (method == NULL) {
+    runtimeError("Undefined property '%s'.", name->chars);
+    return false;
+  }
+  updateCache(cache, instance->shape, -1, method, NULL);
+  bindClosure(method);
+  return true;
+}
+
+static void setProperty(ObjInstance *instance, ObjString *name, Value value,
+                        InlineCache *cache) {
+  ObjShape *before = instance->shape;
+  bool isNewField = instanceSetField(instance, name, value);
+  if (before == NULL || instance->shape == NULL)
+    return;
+
+  if (isNewField) {
+    updateCache(cache, before, instance->shape->fieldCount - 1, NULL,
+                instance->shape);
+  } else {
+    updateCache(cache, before, shapeFieldIndex(before, name), NULL, NULL);
+  }
+}
+
 static void closeUpvalues(Value *last) {
   while (vm.openUpvalues != NULL && vm.openUpvalues->location >= last) {
     ObjUpvalue *upvalue = vm.openUpvalues;
     upvalue->closed = *upvalue->location;
     upvalue->location = &upvalue->closed;
+    writeBarrierValue((Obj *)upvalue, upvalue->closed);
     vm.openUpvalues = upvalue->next;
   }
 }
 
 static bool invokeFromClass(ObjClass *className, ObjString *name,
                             int argCount) {
-  Value method;
-  if (!tableGet(&className->methods, name, &method)) {
+  ObjClosure *method = findMethod(className, name);
+  if (method == NULL) {
     runtimeError("Undefined property '%s'.", name->chars);
     return false;
   }
-  return call(AS_CLOSURE(method), argCount);
+  return call(method, argCount);
 }
 
-static bool invoke(ObjString *name, int argCount) {
+static bool invoke(ObjString *name, int argCount, InlineCache *cache) {
   Value receiver = peek(argCount);
-  if (!IS_INSTANCE(peek(0))) {
+  if (!IS_INSTANCE(receiver)) {
     runtimeError("Only instances have properties to access");
     return false;
   }
 
   ObjInstance *instance = AS_INSTANCE(receiver);
 
+  InlineCacheEntry *entry = findCacheEntry(cache, instance->shape);
+  if (entry != NULL && entry->method != NULL) {
+    return call(entry->method, argCount);
+  }
+
   Value value;
-  if (tableGet(&instance->fields, name, &value)) {
+  if (instanceGetField(instance, name, &value)) {
     vm.stackTop[-argCount - 1] = value;
     return callValue(value, argCount);
   }
-  return invokeFromClass(instance->className, name, argCount);
+
+  ObjClosure *method = findMethod(instance->className, name);
+  if (method == NULL) {
+    runtimeError("Undefined property '%s'.", name->chars);
+    return false;
+  }
+  updateCache(cache, instance->shape, -1, method, NULL);
+  return call(method, argCount);
+}
+
+#ifdef DEBUG_TRACE_EXECUTION
+static void traceInstruction(CallFrame *frame, uint8_t *ip) {
+  printf("    ");
+
+  for (Value *slot = vm.stack; slot < vm.stackTop; slot++) {
+    printf("[");
+    printValue(*slot);
+    printf("]");
+  }
+
+  printf("\n");
+  disassembleInstruction(
+      &frame->closure->function->chunk,
+      (int)(ip - frame->closure->function->chunk.code));
 }
+#endif
+
+#if defined(DEBUG_COUNT_PAIRS)
+#define COUNT_DISPATCH() countPair(*ip)
+#elif defined(DEBUG_COUNT_DISPATCH)
+#define COUNT_DISPATCH() (dispatchCount++)
+#else
+#define COUNT_DISPATCH() ((void)0)
+#endif
 
 static InterpretResult run() {
-  CallFrame *frame = &vm.frames[vm.frameCount - 1];
+  CallFrame *frame;
+
+  // the hot bookkeeping of the current frame lives in locals so it can stay
+  // in registers, it is only written back to the frame when something else
+  // needs to see it: calls, returns and runtime errors
+  register uint8_t *ip;
+  register Value *slots;
+  register Value *constants;
+  InlineCache *caches;
+
+#define STORE_FRAME() (frame->ip = ip)
+#define LOAD_FRAME()                                                           \
+  do {                                                                         \
+    frame = &vm.frames[vm.frameCount - 1];                                     \
+    ip = frame->ip;                                                            \
+    slots = frame->slots;                                                      \
+    constants = frame->closure->function->chunk.constants.values;              \
+    caches = frame->closure->function->chunk.caches;                           \
+  } while (false)
+
+// runs the current function's native code from ip if it has any, the native
+// code returns the ip to carry on interpreting from
+#define RESUME_JIT()                                                           \
+  do {                                                                         \
+    ObjFunction *function = frame->closure->function;                          \
+    if (function->jit != NULL) {                                               \
+      ip = jitEnter(function, slots, ip);                                      \
+    }                                                                          \
+  } while (false)
+
+// calls and loop back edges count towards compiling a function
+#define ENTER_JIT()                                                            \
+  do {                                                                         \
+    ObjFunction *function = frame->closure->function;                          \
+    if (function->jit == NULL && !function->jitFailed && vm.jitEnabled &&      \
+        ++function->hotness >= JIT_THRESHOLD) {                                \
+      jitCompile(function);                                                    \
+    }                                                                          \
+    RESUME_JIT();                                                              \
+  } while (false)
+
+#define RUNTIME_ERROR(...)                                                     \
+  do {                                                                         \
+    STORE_FRAME();                                                             \
+    runtimeError(__VA_ARGS__);                                                 \
+    return INTERPRET_RUNTIME_ERROR;                                            \
+  } while (false)
 
-#define READ_BYTE() (*frame->ip++)
-#define READ_CONSTANT()                                                        \
-  (frame->closure->function->chunk.constants.values[READ_BYTE()])
+#define READ_BYTE() (*ip++)
+#define READ_CONSTANT() (constants[READ_BYTE()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
-#define READ_SHORT()                                                           \
-  (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+#define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
 
-#define BINARY_OP(valueType, op)                                               \
+// rewrites the instruction just read so later runs of this site execute
+// the given opcode instead
+#define QUICKEN(op) (ip[-1] = (op))
+
+// undoes a quickened instruction after a type miss and backs up so the
+// next dispatch runs the generic form on the same operands
+#define DEOPTIMIZE(op)                                                         \
+  do {                                                                         \
+    ip[-1] = (op);                                                             \
+    ip--;                                                                      \
+  } while (false)
+
+#define BINARY_OP(valueType, op, quickOp)                                      \
   do {                                                                         \
     if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                          \
-      runtimeError("Operands must be numbers.");                               \
-      return INTERPRET_RUNTIME_ERROR;                                          \
+      RUNTIME_ERROR("Operands must be numbers.");                              \
     }                                                                          \
     double b = AS_NUMBER(pop());                                               \
     double a = AS_NUMBER(pop());                                               \
     push(valueType(a op b));                                                   \
+    QUICKEN(quickOp);                                                          \
   } while (false)
 
-  for (;;) {
-#ifdef DEBUG_TRACE_EXECUTION
-    printf("    ");
+// superinstructions read their operands straight from locals and constants
+// instead of the stack
+#define ADD_VALUES(a, b)                                                       \
+  do {                                                                         \
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {                                        \
+      push(NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)));                           \
+    } else if (IS_TEXT(a) && IS_TEXT(b)) {                                     \
+      push(a);                                                                 \
+      push(b);                                                                 \
+      concatenate();                                                           \
+    } else {                                                                   \
+      RUNTIME_ERROR("Operands must be two numbers or strings.");               \
+    }                                                                          \
+  } while (false)
 
-    for (Value *slot = vm.stack; slot < vm.stackTop; slot++) {
-      printf("[");
-      printValue(*slot);
-      printf("]");
-    }
+// leaves false on the stack for the jump target's pop like OP_JUMP_IF_FALSE
+#define COMPARE_JUMP(a, op, b)                                                 \
+  do {                                                                         \
+    uint16_t offset = READ_SHORT();                                            \
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) {                                      \
+      RUNTIME_ERROR("Operands must be numbers.");                              \
+    }                                                                          \
+    if (!(AS_NUMBER(a) op AS_NUMBER(b))) {                                     \
+      push(BOOL_VAL(false));                                                   \
+      ip += offset;                                                            \
+    }                                                                          \
+  } while (false)
+
+#define READ_REGISTER(isConstant)                                              \
+  ((isConstant) ? constants[READ_BYTE()] : slots[READ_BYTE()])
+
+#define REGISTER_OP(op)                                                        \
+  do {                                                                         \
+    uint8_t dst = READ_BYTE();                                                 \
+    uint8_t mode = READ_BYTE();                                                \
+    Value a = READ_REGISTER(mode & REGISTER_A_CONSTANT);                       \
+    Value b = READ_REGISTER(mode & REGISTER_B_CONSTANT);                       \
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) {                                      \
+      RUNTIME_ERROR("Operands must be numbers.");                              \
+    }                                                                          \
+    slots[dst] = NUMBER_VAL(AS_NUMBER(a) op AS_NUMBER(b));                     \
+  } while (false)
 
-    printf("\n");
-    disassembleInstruction(
-        &frame->closure->function->chunk,
-        (int)(frame->ip - frame->closure->function->chunk.code));
+#define NUMBER_OP(valueType, op, genericOp)                                    \
+  do {                                                                         \
+    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                          \
+      DEOPTIMIZE(genericOp);                                                   \
+      break;                                                                   \
+    }                                                                          \
+    double b = AS_NUMBER(pop());                                               \
+    double a = AS_NUMBER(pop());                                               \
+    push(valueType(a op b));                                                   \
+  } while (false)
+
+#ifdef DEBUG_TRACE_EXECUTION
+#define TRACE_INSTRUCTION() traceInstruction(frame, ip)
+#else
+#define TRACE_INSTRUCTION() ((void)0)
+#endif
+
+#ifdef THREADED_DISPATCH
+  // one indirect jump per handler instead of the single shared one at the
+  // top of the switch, every handler jumps straight to the next one
+  static void *dispatchTable[] = {
+      [OP_CONSTANT] = &&TARGET_OP_CONSTANT,
+      [OP_NIL] = &&TARGET_OP_NIL,
+      [OP_TRUE] = &&TARGET_OP_TRUE,
+      [OP_FALSE] = &&TARGET_OP_FALSE,
+      [OP_POP] = &&TARGET_OP_POP,
+      [OP_DEFINE_GLOBAL] = &&TARGET_OP_DEFINE_GLOBAL,
+      [OP_GET_GLOBAL] = &&TARGET_OP_GET_GLOBAL,
+      [OP_SET_GLOBAL] = &&TARGET_OP_SET_GLOBAL,
+      [OP_GET_LOCAL] = &&TARGET_OP_GET_LOCAL,
+      [OP_SET_LOCAL] = &&TARGET_OP_SET_LOCAL,
+      [OP_SET_UPVALUE] = &&TARGET_OP_SET_UPVALUE,
+      [OP_GET_UPVALUE] = &&TARGET_OP_GET_UPVALUE,
+      [OP_CLOSE_UPVALUE] = &&TARGET_OP_CLOSE_UPVALUE,
+      [OP_EQUAL] = &&TARGET_OP_EQUAL,
+      [OP_GREATER] = &&TARGET_OP_GREATER,
+      [OP_LESS] = &&TARGET_OP_LESS,
+      [OP_ADD] = &&TARGET_OP_ADD,
+      [OP_SUBTRACT] = &&TARGET_OP_SUBTRACT,
+      [OP_MULTIPLY] = &&TARGET_OP_MULTIPLY,
+      [OP_DIVIDE] = &&TARGET_OP_DIVIDE,
+      [OP_NOT] = &&TARGET_OP_NOT,
+      [OP_NEGATE] = &&TARGET_OP_NEGATE,
+      [OP_PRINT] = &&TARGET_OP_PRINT,
+      [OP_JUMP_IF_FALSE] = &&TARGET_OP_JUMP_IF_FALSE,
+      [OP_JUMP] = &&TARGET_OP_JUMP,
+      [OP_LOOP] = &&TARGET_OP_LOOP,
+      [OP_RETURN] = &&TARGET_OP_RETURN,
+      [OP_CALL] = &&TARGET_OP_CALL,
+      [OP_CLOSURE] = &&TARGET_OP_CLOSURE,
+      [OP_CLASS] = &&TARGET_OP_CLASS,
+      [OP_METHOD] = &&TARGET_OP_METHOD,
+      [OP_GET_INST] = &&TARGET_OP_GET_INST,
+      [OP_SET_INST] = &&TARGET_OP_SET_INST,
+      [OP_INVOKE] = &&TARGET_OP_INVOKE,
+      [OP_GET_SUPER] = &&TARGET_OP_GET_SUPER,
+      [OP_INVOKE_SUPER] = &&TARGET_OP_INVOKE_SUPER,
+      [OP_INHERIT] = &&TARGET_OP_INHERIT,
+      [OP_ADD_NUM_NUM] = &&TARGET_OP_ADD_NUM_NUM,
+      [OP_ADD_STR_STR] = &&TARGET_OP_ADD_STR_STR,
+      [OP_SUBTRACT_NUM_NUM] = &&TARGET_OP_SUBTRACT_NUM_NUM,
+      [OP_MULTIPLY_NUM_NUM] = &&TARGET_OP_MULTIPLY_NUM_NUM,
+      [OP_DIVIDE_NUM_NUM] = &&TARGET_OP_DIVIDE_NUM_NUM,
+      [OP_GREATER_NUM_NUM] = &&TARGET_OP_GREATER_NUM_NUM,
+      [OP_LESS_NUM_NUM] = &&TARGET_OP_LESS_NUM_NUM,
+      [OP_ADD_LOCAL_LOCAL] = &&TARGET_OP_ADD_LOCAL_LOCAL,
+      [OP_ADD_LOCAL_CONST] = &&TARGET_OP_ADD_LOCAL_CONST,
+      [OP_SUBTRACT_LOCAL_CONST] = &&TARGET_OP_SUBTRACT_LOCAL_CONST,
+      [OP_LESS_LOCAL_CONST_JUMP] = &&TARGET_OP_LESS_LOCAL_CONST_JUMP,
+      [OP_GREATER_LOCAL_CONST_JUMP] = &&TARGET_OP_GREATER_LOCAL_CONST_JUMP,
+      [OP_GET_LOCAL_INST] = &&TARGET_OP_GET_LOCAL_INST,
+      [OP_JUMP_IF_FALSE_POP] = &&TARGET_OP_JUMP_IF_FALSE_POP,
+      [OP_SET_LOCAL_POP] = &&TARGET_OP_SET_LOCAL_POP,
+      [OP_ADD_REG] = &&TARGET_OP_ADD_REG,
+      [OP_SUBTRACT_REG] = &&TARGET_OP_SUBTRACT_REG,
+      [OP_MULTIPLY_REG] = &&TARGET_OP_MULTIPLY_REG,
+      [OP_DIVIDE_REG] = &&TARGET_OP_DIVIDE_REG,
+      [OP_MOVE_REG] = &&TARGET_OP_MOVE_REG,
+  };
+
+#define CASE(op)                                                               \
+  case op:                                                                     \
+  TARGET_##op
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    COUNT_DISPATCH();                                                          \
+    TRACE_INSTRUCTION();                                                       \
+    goto *dispatchTable[READ_BYTE()];                                          \
+  } while (false)
+#else
+#define CASE(op) case op
+#define DISPATCH() continue
 #endif
 
-    uint8_t instruction;
-    switch (instruction = READ_BYTE()) {
+  LOAD_FRAME();
 
-    case OP_RETURN: {
+  // the switch is only entered once per run() when dispatch is threaded
+  for (;;) {
+    COUNT_DISPATCH();
+    TRACE_INSTRUCTION();
+
+    switch (READ_BYTE()) {
+
+    CASE(OP_RETURN): {
       Value result = pop();
-      closeUpvalues(frame->slots);
+      if (frame->isConstruction) {
+        recordFieldHint(result);
+      }
+      closeUpvalues(slots);
       vm.frameCount--;
 
       // end of program
@@ -307,115 +782,219 @@ static InterpretResult run() {
       }
 
       // push frame back by 1 and push return val back
-      vm.stackTop = frame->slots;
+      vm.stackTop = slots;
       push(result);
-      frame = &vm.frames[vm.frameCount - 1];
-      break;
+      LOAD_FRAME();
+      RESUME_JIT();
+      DISPATCH();
     }
 
-    case OP_POP:
+    CASE(OP_POP):
       pop();
-      break;
+      DISPATCH();
 
-    case OP_DEFINE_GLOBAL: {
-      ObjString *name = READ_STRING();
-      tableSet(&vm.globals, name, peek(0));
-      pop();
-      break;
+    CASE(OP_DEFINE_GLOBAL): {
+      GlobalVar *global = &vm.globals[READ_SHORT()];
+      global->value = pop();
+      global->isDefined = true;
+      DISPATCH();
     }
 
-    case OP_CALL: {
+    CASE(OP_CALL): {
       int argCount = READ_BYTE();
+      STORE_FRAME();
       if (!callValue(peek(argCount), argCount)) {
         return INTERPRET_RUNTIME_ERROR;
       }
-      frame = &vm.frames[vm.frameCount - 1];
-      break;
+      LOAD_FRAME();
+      ENTER_JIT();
+      DISPATCH();
     }
 
-    case OP_GET_GLOBAL: {
-      ObjString *name = READ_STRING();
-      Value value;
-      if (!tableGet(&vm.globals, name, &value)) {
-        runtimeError("Undefined variable '%s'.", name->chars);
-        return INTERPRET_RUNTIME_ERROR;
+    CASE(OP_GET_GLOBAL): {
+      GlobalVar *global = &vm.globals[READ_SHORT()];
+      if (!global->isDefined) {
+        RUNTIME_ERROR("Undefined variable '%s'.", global->name->chars);
       }
-      push(value);
-      break;
+      push(global->value);
+      DISPATCH();
     }
 
-    case OP_GET_LOCAL: {
+    CASE(OP_GET_LOCAL): {
       uint8_t slot = READ_BYTE();
-      push(frame->slots[slot]);
-      break;
+      push(slots[slot]);
+      DISPATCH();
     }
 
-    case OP_SET_LOCAL: {
+    CASE(OP_SET_LOCAL): {
       uint8_t slot = READ_BYTE();
-      frame->slots[slot] = peek(0);
-      break;
+      slots[slot] = peek(0);
+      DISPATCH();
     }
 
-    case OP_SET_GLOBAL: {
-      ObjString *name = READ_STRING();
-      if (tableSet(&vm.globals, name, peek(0))) {
-        tableDelete(&vm.globals, name);
-        runtimeError("Undefined variable '%s'.", name->chars);
-        return INTERPRET_RUNTIME_ERROR;
+    CASE(OP_SET_LOCAL_POP): {
+      uint8_t slot = READ_BYTE();
+      slots[slot] = pop();
+      DISPATCH();
+    }
+
+    CASE(OP_ADD_LOCAL_LOCAL): {
+      Value a = slots[READ_BYTE()];
+      Value b = slots[READ_BYTE()];
+      ADD_VALUES(a, b);
+      DISPATCH();
+    }
+
+    CASE(OP_ADD_LOCAL_CONST): {
+      Value a = slots[READ_BYTE()];
+      Value b = READ_CONSTANT();
+      ADD_VALUES(a, b);
+      DISPATCH();
+    }
+
+    CASE(OP_SUBTRACT_LOCAL_CONST): {
+      Value a = slots[READ_BYTE()];
+      Value b = READ_CONSTANT();
+      if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+        RUNTIME_ERROR("Operands must be numbers.");
       }
-      break;
+      push(NUMBER_VAL(AS_NUMBER(a) - AS_NUMBER(b)));
+      DISPATCH();
+    }
+
+    CASE(OP_LESS_LOCAL_CONST_JUMP): {
+      Value a = slots[READ_BYTE()];
+      Value b = READ_CONSTANT();
+      COMPARE_JUMP(a, <, b);
+      DISPATCH();
+    }
+
+    CASE(OP_GREATER_LOCAL_CONST_JUMP): {
+      Value a = slots[READ_BYTE()];
+      Value b = READ_CONSTANT();
+      COMPARE_JUMP(a, >, b);
+      DISPATCH();
+    }
+
+    CASE(OP_ADD_REG): {
+      uint8_t dst = READ_BYTE();
+      uint8_t mode = READ_BYTE();
+      Value a = READ_REGISTER(mode & REGISTER_A_CONSTANT);
+      Value b = READ_REGISTER(mode & REGISTER_B_CONSTANT);
+      if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        slots[dst] = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+      } else if (IS_TEXT(a) && IS_TEXT(b)) {
+        push(a);
+        push(b);
+        concatenate();
+        slots[dst] = pop();
+      } else {
+        RUNTIME_ERROR("Operands must be two numbers or strings.");
+      }
+      DISPATCH();
+    }
+
+    CASE(OP_SUBTRACT_REG):
+      REGISTER_OP(-);
+      DISPATCH();
+
+    CASE(OP_MULTIPLY_REG):
+      REGISTER_OP(*);
+      DISPATCH();
+
+    CASE(OP_DIVIDE_REG):
+      REGISTER_OP(/);
+      DISPATCH();
+
+    CASE(OP_MOVE_REG): {
+      uint8_t dst = READ_BYTE();
+      uint8_t mode = READ_BYTE();
+      slots[dst] = READ_REGISTER(mode & REGISTER_A_CONSTANT);
+      DISPATCH();
     }
 
-    case OP_JUMP_IF_FALSE: {
+    CASE(OP_SET_GLOBAL): {
+      GlobalVar *global = &vm.globals[READ_SHORT()];
+      if (!global->isDefined) {
+        RUNTIME_ERROR("Undefined variable '%s'.", global->name->chars);
+      }
+      global->value = peek(0);
+      DISPATCH();
+    }
+
+    CASE(OP_JUMP_IF_FALSE): {
       uint16_t offset = READ_SHORT();
       if (isFalsey(peek(0)))
-        frame->ip += offset;
-      break;
+        ip += offset;
+      DISPATCH();
     }
 
-    case OP_LOOP: {
+    CASE(OP_JUMP_IF_FALSE_POP): {
       uint16_t offset = READ_SHORT();
-      frame->ip -= offset;
-      break;
+      if (isFalsey(peek(0))) {
+        ip += offset;
+      } else {
+        pop();
+      }
+      DISPATCH();
     }
 
-    case OP_JUMP: {
+    CASE(OP_LOOP): {
       uint16_t offset = READ_SHORT();
-      frame->ip += offset;
-      break;
+      ip -= offset;
+      ENTER_JIT();
+      DISPATCH();
+    }
+
+    CASE(OP_JUMP): {
+      uint16_t offset = READ_SHORT();
+      ip += offset;
+      DISPATCH();
     }
 
-    case OP_PRINT:
+    CASE(OP_PRINT):
       printValue(pop());
       printf("\n");
-      break;
+      DISPATCH();
 
-    case OP_NEGATE:
+    CASE(OP_NEGATE):
       if (!IS_NUMBER(peek(0))) {
-        runtimeError("Operand must be a number.");
-        return INTERPRET_RUNTIME_ERROR;
+        RUNTIME_ERROR("Operand must be a number.");
       }
       push(NUMBER_VAL(-AS_NUMBER(pop())));
-      break;
+      DISPATCH();
 
-    case OP_NOT:
+    CASE(OP_NOT):
       push(BOOL_VAL(isFalsey(pop())));
-      break;
+      DISPATCH();
 
-    case OP_ADD:
-      if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-        concatenate();
-      } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+    CASE(OP_ADD):
+      if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
         double b = AS_NUMBER(pop());
         double a = AS_NUMBER(pop());
         push(NUMBER_VAL(a + b));
+        QUICKEN(OP_ADD_NUM_NUM);
+      } else if (IS_TEXT(peek(0)) && IS_TEXT(peek(1))) {
+        concatenate();
+        QUICKEN(OP_ADD_STR_STR);
       } else {
-        runtimeError("Operands must be two numbers or strings.");
-        return INTERPRET_RUNTIME_ERROR;
+        RUNTIME_ERROR("Operands must be two numbers or strings.");
       }
-      break;
+      DISPATCH();
+
+    CASE(OP_ADD_NUM_NUM):
+      NUMBER_OP(NUMBER_VAL, +, OP_ADD);
+      DISPATCH();
+
+    CASE(OP_ADD_STR_STR):
+      if (IS_TEXT(peek(0)) && IS_TEXT(peek(1))) {
+        concatenate();
+      } else {
+        DEOPTIMIZE(OP_ADD);
+      }
+      DISPATCH();
 
-    case OP_CLOSURE: {
+    CASE(OP_CLOSURE): {
       ObjFunction *function = AS_FUNCTION((READ_CONSTANT()));
       ObjClosure *closure = newClosure(function);
       push(OBJ_VAL(closure));
@@ -425,181 +1004,241 @@ static InterpretResult run() {
         uint8_t index = READ_BYTE();
 
         if (isLocal) {
-          closure->upvalues[i] = captureUpvalues(frame->slots + index);
+          closure->upvalues[i] = captureUpvalues(slots + index);
         } else {
           closure->upvalues[i] = frame->closure->upvalues[index];
         }
+        // capturing can collect and promote the closure
+        writeBarrier((Obj *)closure, (Obj *)closure->upvalues[i]);
       }
-      break;
+      DISPATCH();
     }
 
-    case OP_INHERIT: {
+    CASE(OP_INHERIT): {
       Value superClass = peek(1);
       if (!IS_CLASS(superClass)) {
-        runtimeError("Superclass must be a class");
-        return INTERPRET_RUNTIME_ERROR;
+        RUNTIME_ERROR("Superclass must be a class");
       }
       ObjClass *subClass = AS_CLASS(peek(0));
-      tableAddAll(&AS_CLASS(superClass)->methods, &subClass->methods);
+      inheritMethods(AS_CLASS(superClass), subClass);
       pop();
-      break;
+      DISPATCH();
     }
 
-    case OP_CLASS:
+    CASE(OP_CLASS):
       push(OBJ_VAL(newClass(READ_STRING())));
-      break;
+      DISPATCH();
 
-    case OP_METHOD:
+    CASE(OP_METHOD):
       defineMethod(READ_STRING());
-      break;
+      DISPATCH();
 
-    case OP_SET_INST: {
+    CASE(OP_SET_INST): {
       if (!IS_INSTANCE(peek(1))) {
-        runtimeError("Only instances have fields to access");
-        return INTERPRET_RUNTIME_ERROR;
+        RUNTIME_ERROR("Only instances have fields to access");
       }
       ObjString *name = READ_STRING();
+      InlineCache *cache = &caches[READ_SHORT()];
       ObjInstance *obj = AS_INSTANCE(peek(1));
 
+      InlineCacheEntry *entry = findCacheEntry(cache, obj->shape);
+      if (entry != NULL && entry->transition == NULL) {
+        obj->fields[entry->index] = peek(0);
+        writeBarrierValue((Obj *)obj, peek(0));
+      } else if (entry != NULL && entry->index < obj->fieldCapacity) {
+        obj->fields[entry->index] = peek(0);
+        obj->shape = entry->transition;
+        noteFieldAdded(obj);
+        writeBarrierValue((Obj *)obj, peek(0));
+        writeBarrier((Obj *)obj, (Obj *)obj->shape);
+      } else {
+        setProperty(obj, name, peek(0), cache);
+      }
+
       Value value = pop();
-      tableSet(&(obj->fields), name, value);
       pop();
       push(value);
-      break;
+      DISPATCH();
     }
-    case OP_GET_INST: {
+    // pushes the local and carries on as OP_GET_INST, whose operands follow
+    CASE(OP_GET_LOCAL_INST):
+      push(slots[READ_BYTE()]);
+      // fall through
+    CASE(OP_GET_INST): {
       if (!IS_INSTANCE(peek(0))) {
-        runtimeError("Only instances have properties to access");
-        return INTERPRET_RUNTIME_ERROR;
+        RUNTIME_ERROR("Only instances have properties to access");
       }
       ObjInstance *obj = AS_INSTANCE(peek(0));
       ObjString *name = READ_STRING();
-      Value field;
-      // find variable in instance
-      if (tableGet(&(obj->fields), name, &field)) {
-        pop();
-        push(field);
-        break;
+      InlineCache *cache = &caches[READ_SHORT()];
+
+      InlineCacheEntry *entry = findCacheEntry(cache, obj->shape);
+      if (entry != NULL) {
+        if (entry->method == NULL) {
+          vm.stackTop[-1] = obj->fields[entry->index];
+        } else {
+          bindClosure(entry->method);
+        }
+        DISPATCH();
       }
 
-      // find method in class & bind it if found
-      if (!bindMethod(obj->className, name)) {
+      STORE_FRAME();
+      if (!getProperty(obj, name, cache)) {
         return INTERPRET_RUNTIME_ERROR;
       }
-
-      break;
+      DISPATCH();
     }
 
-    case OP_GET_UPVALUE: {
+    CASE(OP_GET_UPVALUE): {
       uint8_t slot = READ_BYTE();
       push(*frame->closure->upvalues[slot]->location);
-      break;
+      DISPATCH();
     }
 
-    case OP_SET_UPVALUE: {
+    CASE(OP_SET_UPVALUE): {
       uint8_t slot = READ_BYTE();
-      *frame->closure->upvalues[slot]->location = peek(0);
-      break;
+      ObjUpvalue *upvalue = frame->closure->upvalues[slot];
+      *upvalue->location = peek(0);
+      writeBarrierValue((Obj *)upvalue, peek(0));
+      DISPATCH();
     }
 
-    case OP_CLOSE_UPVALUE:
+    CASE(OP_CLOSE_UPVALUE):
       closeUpvalues(vm.stackTop - 1);
       pop();
-      break;
+      DISPATCH();
 
-    case OP_SUBTRACT:
-      BINARY_OP(NUMBER_VAL, -);
-      break;
+    CASE(OP_SUBTRACT):
+      BINARY_OP(NUMBER_VAL, -, OP_SUBTRACT_NUM_NUM);
+      DISPATCH();
 
-    case OP_MULTIPLY:
-      BINARY_OP(NUMBER_VAL, *);
-      break;
+    CASE(OP_MULTIPLY):
+      BINARY_OP(NUMBER_VAL, *, OP_MULTIPLY_NUM_NUM);
+      DISPATCH();
 
-    case OP_DIVIDE:
-      BINARY_OP(NUMBER_VAL, /);
-      break;
+    CASE(OP_DIVIDE):
+      BINARY_OP(NUMBER_VAL, /, OP_DIVIDE_NUM_NUM);
+      DISPATCH();
 
-    case OP_CONSTANT: {
+    CASE(OP_SUBTRACT_NUM_NUM):
+      NUMBER_OP(NUMBER_VAL, -, OP_SUBTRACT);
+      DISPATCH();
+
+    CASE(OP_MULTIPLY_NUM_NUM):
+      NUMBER_OP(NUMBER_VAL, *, OP_MULTIPLY);
+      DISPATCH();
+
+    CASE(OP_DIVIDE_NUM_NUM):
+      NUMBER_OP(NUMBER_VAL, /, OP_DIVIDE);
+      DISPATCH();
+
+    CASE(OP_CONSTANT): {
       Value constant = READ_CONSTANT();
       push(constant);
-      break;
+      DISPATCH();
     }
 
-    case OP_NIL:
+    CASE(OP_NIL):
       push(NIL_VAL);
-      break;
+      DISPATCH();
 
-    case OP_TRUE:
+    CASE(OP_TRUE):
       push(BOOL_VAL(true));
-      break;
+      DISPATCH();
 
-    case OP_FALSE:
+    CASE(OP_FALSE):
       push(BOOL_VAL(false));
-      break;
+      DISPATCH();
 
-    case OP_EQUAL: {
+    CASE(OP_EQUAL): {
+      // ropes are flattened so they compare by content like strings
+      flattenOperand(0);
+      flattenOperand(1);
       Value b = pop();
       Value a = pop();
       push(BOOL_VAL(valuesEqual(a, b)));
-      break;
+      DISPATCH();
+    }
 
-    case OP_GREATER:
-      BINARY_OP(BOOL_VAL, >);
-      break;
+    CASE(OP_GREATER):
+      BINARY_OP(BOOL_VAL, >, OP_GREATER_NUM_NUM);
+      DISPATCH();
 
-    case OP_LESS:
-      BINARY_OP(BOOL_VAL, <);
-      break;
+    CASE(OP_LESS):
+      BINARY_OP(BOOL_VAL, <, OP_LESS_NUM_NUM);
+      DISPATCH();
+
+    CASE(OP_GREATER_NUM_NUM):
+      NUMBER_OP(BOOL_VAL, >, OP_GREATER);
+      DISPATCH();
 
-    case OP_INVOKE: {
+    CASE(OP_LESS_NUM_NUM):
+      NUMBER_OP(BOOL_VAL, <, OP_LESS);
+      DISPATCH();
+
+    CASE(OP_INVOKE): {
       ObjString *method = READ_STRING();
       int argCount = READ_BYTE();
-      if (!invoke(method, argCount)) {
+      InlineCache *cache = &caches[READ_SHORT()];
+      STORE_FRAME();
+      if (!invoke(method, argCount, cache)) {
         return INTERPRET_RUNTIME_ERROR;
       }
-      frame = &vm.frames[vm.frameCount - 1];
-      break;
+      LOAD_FRAME();
+      ENTER_JIT();
+      DISPATCH();
     }
 
-    case OP_INVOKE_SUPER: {
+    CASE(OP_INVOKE_SUPER): {
       ObjString *method = READ_STRING();
       int argCount = READ_BYTE();
       ObjClass *super = AS_CLASS(pop());
 
+      STORE_FRAME();
       if (!invokeFromClass(super, method, argCount)) {
         return INTERPRET_RUNTIME_ERROR;
       }
-
-      frame = &vm.frames[vm.frameCount - 1];
-      break;
+      LOAD_FRAME();
+      ENTER_JIT();
+      DISPATCH();
     }
 
-    case OP_GET_SUPER: {
+    CASE(OP_GET_SUPER): {
       ObjString *method = READ_STRING();
       ObjClass *super = AS_CLASS(pop());
 
+      STORE_FRAME();
       if (!bindMethod(super, method)) {
         return INTERPRET_RUNTIME_ERROR;
       }
-      break;
-    }
+      DISPATCH();
     }
     }
   }
 
+#undef DISPATCH
+#undef CASE
+#undef TRACE_INSTRUCTION
+#undef STORE_FRAME
+#undef LOAD_FRAME
+#undef RUNTIME_ERROR
+#undef RESUME_JIT
+#undef ENTER_JIT
 #undef READ_SHORT
 #undef READ_BYTE
 #undef READ_CONSTANT
 #undef READ_STRING
 #undef BINARY_OP
+#undef NUMBER_OP
+#undef ADD_VALUES
+#undef READ_REGISTER
+#undef REGISTER_OP
+#undef COMPARE_JUMP
+#undef QUICKEN
+#undef DEOPTIMIZE
 }
 
-InterpretResult interpret(const char *source) {
-  ObjFunction *function = compile(source);
-  if (function == NULL) {
-    return INTERPRET_COMPILE_ERROR;
-  }
-
+InterpretResult interpretFunction(ObjFunction *function) {
   push(OBJ_VAL(function));
 
   ObjClosure *closure = newClosure(function);
@@ -609,3 +1248,12 @@ InterpretResult interpret(const char *source) {
 
   return run();
 }
+
+InterpretResult interpret(const char *source) {
+  ObjFunction *function = compile(source);
+  if (function == NULL) {
+    return INTERPRET_COMPILE_ERROR;
+  }
+
+  return interpretFunction(function);
+}